@@ -12,44 +12,94 @@
 #include <iostream>
 #include <string>
 #include <queue>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+#include <sys/time.h>
 #include "PtrInterface.h"
 #include "Ptr.h"
 
 #include "Nominal.h"
 #include "Numeric.h"
 #include "Notifiee.h"
+#include "Exception.h"
 
 using namespace std;
 
-class Time : public Numeric<Time, double> {
+class Time : public Numeric<Time, int64_t> {
 public:
     // Types
-    static const double SEC_TO_NANO = 1000000000;
-    static const double USEC_TO_NANO = 1000;
-    static const double DEFAULT = 0.0;
+    static const int64_t SEC_TO_NANO = 1000000000;
+    static const int64_t USEC_TO_NANO = 1000;
+    static const int64_t DEFAULT = 0;
+    static const int64_t NEVER = 0x7fffffffffffffffLL;
+    static const int64_t MIN = -NEVER - 1;
 
     /*
-     * convert struct timeval to nanosecond
+     * convert nanosecond to struct timeval
      */
     operator struct timeval() {
         struct timeval tv;
 
-        tv.tv_usec = (unsigned)(value() / 1000);
-        tv.tv_usec %= 1000000;
-        tv.tv_sec = (unsigned)(value() / 1000000000.0);
+        tv.tv_sec = value_ / SEC_TO_NANO;
+        tv.tv_usec = (value_ % SEC_TO_NANO) / USEC_TO_NANO;
 
         return tv;
     }
 
+    /*
+     * Saturating arithmetic: results are clamped to [MIN, NEVER] and
+     * Never stays Never no matter what is added to or taken from it
+     */
+    Time operator+(const Time &t) const {
+        if (value_ == NEVER || t.value_ == NEVER) {
+            return Time(NEVER);
+        }
+        if (t.value_ > 0 && value_ > NEVER - t.value_) {
+            return Time(NEVER);
+        }
+        if (t.value_ < 0 && value_ < MIN - t.value_) {
+            return Time(MIN);
+        }
+        return Time(value_ + t.value_);
+    }
+    Time operator-(const Time &t) const {
+        if (value_ == NEVER) {
+            return Time(NEVER);
+        }
+        if (t.value_ > 0 && value_ < MIN + t.value_) {
+            return Time(MIN);
+        }
+        if (t.value_ < 0 && value_ > NEVER + t.value_) {
+            return Time(NEVER);
+        }
+        return Time(value_ - t.value_);
+    }
+    const Time& operator+=(const Time &t) { *this = *this + t; return *this; }
+    const Time& operator-=(const Time &t) { *this = *this - t; return *this; }
+
     // Constructor/Destructor
-    Time(const Numeric<Time, double> &t) :Numeric<Time, double>(t) {}
-    Time() :Numeric<Time, double>(DEFAULT) {}
-    Time(const double &t) :Numeric<Time, double>(t) {}
-    Time(const int &t) :Numeric<Time, double>(DEFAULT) { value_ = t * SEC_TO_NANO; }
+    Time(const Numeric<Time, int64_t> &t) :Numeric<Time, int64_t>(t) {}
+    Time() :Numeric<Time, int64_t>(DEFAULT) {}
+    Time(const int64_t &t) :Numeric<Time, int64_t>(t) {}
+    Time(const double &t) :Numeric<Time, int64_t>(DEFAULT) {
+        /*
+         * round to the nearest nanosecond, anything out of range saturates
+         */
+        if (t >= (double)NEVER) {
+            value_ = NEVER;
+        } else if (t <= (double)MIN) {
+            value_ = MIN;
+        } else {
+            value_ = (int64_t)(t < 0 ? t - 0.5 : t + 0.5);
+        }
+    }
+    Time(const int &t) :Numeric<Time, int64_t>(DEFAULT) { value_ = t * SEC_TO_NANO; }
     Time(const struct timeval &t) 
-        :Numeric<Time, double>(DEFAULT) {
-        value_ = 1000000000.0 * t.tv_sec;
-        value_ += 1000.0 * t.tv_usec;
+        :Numeric<Time, int64_t>(DEFAULT) {
+        value_ = (int64_t)t.tv_sec * SEC_TO_NANO;
+        value_ += (int64_t)t.tv_usec * USEC_TO_NANO;
     }
 };
 extern ostream& operator<<(ostream &s, Time t);
@@ -58,49 +108,371 @@ class Activity : public PtrInterface<Activity> {
 public:
     // Types
     typedef Ptr<Activity> Ptr;
+    typedef unsigned int Handle;
     enum Status {Free,Waiting,Ready,Executing};
     static const Time Never;
+    static const Handle NoHandle = (Handle)-1;
     class Manager;
+    class Callback;
+    class Timer;
+    class Profile;
+    class Checkpoint;
 
     // Accessor
     Status          status() const { return status_; }
+    Handle          handle() const { return handle_; }
+    string          label() const { return label_; }
     virtual Time    nextTime() const { return nextTime_; }
-    virtual string  name() const { return name_; }
+    virtual string  name() const;
 
     // Mutator
     virtual void    statusIs(Status s) { status_ = s; }
     virtual void    nextTimeIs(Time t) { nextTime_ = t; statusIs(Waiting); }
     virtual void    lastNotifieeIs(Ptr<RootNotifiee> p) { lastNotifiee_.push_back(p); statusIs(Ready); }
     virtual void    timeoutNotifieeIs(Ptr<RootNotifiee> p) { timeoutNotifiee_ = p; if (status() != Ready) statusIs(Waiting); }
+    virtual void    labelIs(const string &label) { label_ = label; }
 
 protected:
     vector<Ptr<RootNotifiee> >  lastNotifiee_;
     Ptr<RootNotifiee>           timeoutNotifiee_;
 
-    Activity(const string &name) 
-        :name_(name), status_(Free), nextTime_(Activity::Never) {}
+    Activity(const string &name, Handle handle) 
+        :name_(name), handle_(handle), status_(Free), nextTime_(Activity::Never) {}
     virtual ~Activity() {}
 
+    void    handleIs(Handle h) { handle_ = h; }
+
 private:
-    string  name_;
+    string  name_;      // empty for an anonymous activity
+    string  label_;     // groups activities in a profile, need not be unique
+    Handle  handle_;
     Status  status_;
     Time    nextTime_;
 };
 
 
+/**
+ * Activity::Callback:
+ *
+ * a copyable "void f()" callable for Activity::Manager::timerNew.
+ * Callables of up to BufferSize bytes are kept inline in the
+ * callback, larger or more strictly aligned ones are copied to the
+ * heap.  Pass functions by address (&f).
+ */
+class Activity::Callback {
+public:
+    static const unsigned int BufferSize = 4 * sizeof(void *);
+
+    // Accessor
+    bool    empty() const { return ops_ == NULL; }
+
+    // Mutator
+    void    operator()() { ops_->invoke(&storage_); }
+    void    clear() { if (ops_) { ops_->destroy(&storage_); ops_ = NULL; } }
+
+    // Constructor/Destructor
+    Callback() :ops_(NULL) {}
+    template<class F> Callback(const F &f) 
+        :ops_(Store<F, Fits<F>::value>::ops()) {
+        Store<F, Fits<F>::value>::init(&storage_, f);
+    }
+    Callback(const Callback &c) :ops_(NULL) { *this = c; }
+    Callback(Callback &c) :ops_(NULL) { *this = c; }
+    Callback& operator=(const Callback &c) {
+        if (this != &c) {
+            clear();
+            if (c.ops_) {
+                c.ops_->copy(&storage_, &c.storage_);
+                ops_ = c.ops_;
+            }
+        }
+        return *this;
+    }
+    ~Callback() { clear(); }
+
+private:
+    struct Ops {
+        void (*invoke)(void *storage);
+        void (*copy)(void *to, const void *from);
+        void (*destroy)(void *storage);
+    };
+
+    union Storage {
+        void        *pointer;
+        long long   integer;
+        double      real;
+        char        buffer[BufferSize];
+    };
+
+    /*
+     * whether F can be placed in storage_, its size and alignment
+     */
+    template<class F> struct Fits {
+        static const bool value = sizeof(F) <= BufferSize && 
+                                  __alignof__(F) <= __alignof__(Storage);
+    };
+
+    /*
+     * Store<F, true> keeps F in storage_, Store<F, false> keeps a
+     * pointer to a heap copy of F there.  The heap copy is aligned
+     * for F, operator new need not honour an alignment beyond the
+     * fundamental one.
+     */
+    template<class F, bool Inline> struct Store {
+        static void invoke(void *s) { (*static_cast<F *>(s))(); }
+        static void copy(void *to, const void *from) { new (to) F(*static_cast<const F *>(from)); }
+        static void destroy(void *s) { static_cast<F *>(s)->~F(); }
+        static void init(void *s, const F &f) { new (s) F(f); }
+        static const Ops *ops() { static const Ops o = { invoke, copy, destroy }; return &o; }
+    };
+    template<class F> struct Store<F, false> {
+        static void invoke(void *s) { (**static_cast<F **>(s))(); }
+        static void copy(void *to, const void *from) { init(to, **static_cast<F * const *>(from)); }
+        static void destroy(void *s) { F *f = *static_cast<F **>(s); f->~F(); free(f); }
+        static void init(void *s, const F &f) {
+            void *p;
+            if (posix_memalign(&p, __alignof__(F) < sizeof(void *) ? sizeof(void *) : __alignof__(F), sizeof(F))) {
+                throw ResourceException();
+            }
+            try { *static_cast<F **>(s) = new (p) F(f); } catch (...) { free(p); throw; }
+        }
+        static const Ops *ops() { static const Ops o = { invoke, copy, destroy }; return &o; }
+    };
+
+    const Ops   *ops_;
+    Storage     storage_;
+};
+
+/**
+ * Activity::Timer:
+ *
+ * token for a callback scheduled with timerNew, used to cancel it.
+ * The generation tells a live timer from a recycled slot.
+ */
+class Activity::Timer {
+public:
+    static const unsigned int NoTimer = (unsigned int)-1;
+
+    // Accessor
+    unsigned int    index() const { return index_; }
+    unsigned int    generation() const { return generation_; }
+
+    // Constructor/Destructor
+    Timer(unsigned int index = NoTimer, unsigned int generation = 0)
+        :index_(index), generation_(generation) {}
+
+private:
+    unsigned int    index_;
+    unsigned int    generation_;
+};
+
+/**
+ * Activity::Profile:
+ *
+ * execution profile of the activities sharing a profile key: their
+ * label, or for an unlabelled activity its name up to the first ':'.
+ * Timer callbacks are profiled under "timer".  Only kept when built
+ * with ACTIVITY_PROFILE, times are CLOCK_MONOTONIC_RAW.
+ */
+class Activity::Profile {
+public:
+    string              key;
+    unsigned long long  invocations;
+    unsigned long long  notifiees;  // handleNotification calls
+    Time                total;
+    Time                max;
+
+    Profile() :invocations(0), notifiees(0) {}
+};
+
+/**
+ * Activity::Checkpoint:
+ *
+ * versioned binary file holding the state of a simulation.  Values
+ * are base 128 varints read back in the order they were written,
+ * reals the little endian bit pattern of the double.  A wrong magic
+ * or version, or reading past the end, throws RangeException.  A
+ * saved checkpoint is only complete once close has returned, it
+ * throws ResourceException and removes the file if anything could
+ * not be written.  While restoring, activityIs maps the handle an
+ * activity had when it was saved to the one standing in for it.
+ */
+class Activity::Checkpoint : public PtrInterface<Activity::Checkpoint> {
+public:
+    // Types
+    enum Mode {Save,Load};
+    static const unsigned int Version = 2;
+
+    // Accessor
+    Mode                mode() const { return mode_; }
+    string              file() const { return file_; }
+    Activity::Ptr       activity(Activity::Handle saved) const;
+    unsigned long long  integer();          // the next value of the file
+    Time                time();
+    double              real();
+    string              text();
+
+    // Mutator
+    void    integerIs(unsigned long long v);
+    void    timeIs(Time t);
+    void    realIs(double d);
+    void    textIs(const string &s);
+    void    activityIs(Activity::Handle saved, Activity::Ptr activity);
+    void    close();
+
+    // Constructor/Destructor
+    Checkpoint(const string &file, Mode mode);
+    ~Checkpoint();
+
+private:
+    static const char Magic[8];
+
+    string                  file_;
+    Mode                    mode_;
+    FILE                    *stream_;       // NULL once closed
+    long                    size_;          // of the file loaded
+    vector<Activity::Ptr>   activity_;      // by saved handle
+
+    FILE    *stream() const;
 
+    Checkpoint(const Checkpoint &);
+    Checkpoint& operator=(const Checkpoint &);
+};
+
+/**
+ * Activity::Manager:
+ *
+ * timers created with a key run ahead of everything else scheduled
+ * for the same time, in key order (keys below 2^63).  timerPost
+ * schedules a keyed timer on another manager, possibly another
+ * partition run by another thread; the time must be at least one
+ * lookahead ahead of now, an earlier post aborts the run.
+ *
+ * With a non-zero optimism partitions run ahead speculatively and
+ * are rolled back when a posted timer turns out to be late.  While
+ * speculative() is true, whoever changes state outside the manager
+ * registers a callback with undoIs that puts it back.
+ *
+ * A real time manager tracks how late it runs events against the
+ * real clock: the worst lag, a histogram of lags (bucket 0 is below
+ * 1us, bucket i below 2^i us, the last one open ended) and the
+ * number of lags beyond lagThreshold().  Its dilation() is the real
+ * time that passes per unit of virtual time; an adaptive() one tunes
+ * it to the fastest speed that keeps the lag within the threshold.
+ * It may drive several virtual managers, each at a ratio of its own
+ * and starting offset after the real time manager's start.
+ *
+ * Events due at the same time run as one batch before the clock
+ * moves on; batchHistogram counts the batches by size, bucket i
+ * holding those of 2^i up to 2^(i+1) - 1 events.
+ *
+ * profile() lists the execution profiles, most expensive first; it
+ * is empty unless built with ACTIVITY_PROFILE.
+ *
+ * traceIs records every event the manager runs to a file: its time,
+ * the activity handle or timer slot and how it was notified.
+ * replayIs checks a later run against such a trace, event by event,
+ * optionally only between from and to.  An empty file name ends
+ * either; ending a replay reports trace events the run never got to.
+ *
+ * snapshotIs saves the clock and the pending activities to a
+ * checkpoint, restoreIs puts them back in place of whatever is
+ * scheduled, with ties in the same order.  Keyed timers belong to
+ * the model, which saves them itself and posts them again after the
+ * restore; pending unkeyed timers cannot be saved.
+ *
+ * A manager lacking one of these knobs takes only the value its
+ * accessor already reports, anything else throws PermissionException.
+ */
 class Activity::Manager : public PtrInterface<Activity::Manager> {
 public:
+    // Types
+    static const unsigned int LagBuckets = 16;
+    static const unsigned int BatchBuckets = 16;
+
     // Accessor
+    virtual Activity::Ptr   activity(Activity::Handle handle) const = 0;
     virtual Activity::Ptr   activity(const string &name) const = 0;
     virtual Time            now() const = 0;
     virtual bool            running() const { return running_; }
     virtual string          name() const = 0;
+    virtual bool            lazyCancel() const { return false; }
+    virtual double          staleRatio() const { return 0.0; }
+    virtual unsigned int    partitions() const { return 1; }
+    virtual Ptr<Activity::Manager> partition(unsigned int index) const {
+        return index == 0 ? const_cast<Activity::Manager *>(this) : NULL;
+    }
+    virtual Time            lookahead() const { return Activity::Never; }
+    virtual Time            optimism() const { return Time(); }
+    virtual bool            speculative() const { return false; }
+    virtual unsigned long long rollbacks() const { return 0; }
+    virtual double          efficiency() const { return 1.0; }
+    virtual Time            lagMax() const { return Time(); }
+    virtual Time            lagThreshold() const { return Activity::Never; }
+    virtual unsigned long long lagMisses() const { return 0; }
+    virtual unsigned long long lagHistogram(unsigned int bucket) const { return 0; }
+    virtual unsigned int    dilation() const { return 1; }
+    virtual bool            adaptive() const { return false; }
+    virtual unsigned long long batchHistogram(unsigned int bucket) const { return 0; }
+    virtual vector<Activity::Profile> profile() const { return vector<Activity::Profile>(); }
+    virtual unsigned long long traceEvents() const { return 0; }
+    virtual unsigned long long replayMismatches() const { return 0; }
+    virtual unsigned int    virtualManagers() const { return 0; }
+    virtual Ptr<Activity::Manager> virtualManager(unsigned int index) const { return NULL; }
 
     // Mutator
+    virtual Activity::Ptr   activityNew() = 0;
     virtual Activity::Ptr   activityNew(const string &name) = 0;
+    virtual void            activityDel(Activity::Handle handle) = 0;
     virtual void            activityDel(const string &name) = 0;
+    virtual Activity::Timer timerNew(Time t, const Activity::Callback &callback) = 0;
+    virtual Activity::Timer timerNew(Time t, unsigned long long key, 
+                                     const Activity::Callback &callback) = 0;
+    virtual void            timerPost(Activity::Manager *to, Time t, unsigned long long key,
+                                      const Activity::Callback &callback) = 0;
+    virtual void            timerDel(Activity::Timer timer) = 0;
     virtual void            runningIs(bool r) { running_ = r; }
+    virtual void            lazyCancelIs(bool lazy) {
+        if (lazy) throw PermissionException("manager cannot cancel lazily");
+    }
+    virtual void            partitionsIs(unsigned int n) {
+        if (n != 1) throw PermissionException("manager cannot be partitioned");
+    }
+    virtual void            lookaheadIs(Time t) {
+        if (t != Activity::Never) throw PermissionException("manager has no lookahead");
+    }
+    virtual void            optimismIs(Time t) {
+        if (t != Time()) throw PermissionException("manager cannot run optimistically");
+    }
+    virtual void            undoIs(const Activity::Callback &undo) {
+        throw PermissionException("manager does not run speculatively");
+    }
+    virtual void            lagThresholdIs(Time t) {
+        if (t != Activity::Never) throw PermissionException("manager has no lag threshold");
+    }
+    virtual void            traceIs(const string &file) {
+        if (!file.empty()) throw PermissionException("manager cannot trace");
+    }
+    virtual void            replayIs(const string &file, Time from = Time(Time::MIN), 
+                                     Time to = Activity::Never) {
+        if (!file.empty()) throw PermissionException("manager cannot replay");
+    }
+    virtual void            snapshotIs(Ptr<Activity::Checkpoint> checkpoint) {
+        throw PermissionException("manager cannot be checkpointed");
+    }
+    virtual void            restoreIs(Ptr<Activity::Checkpoint> checkpoint) {
+        throw PermissionException("manager cannot be checkpointed");
+    }
+    virtual void            adaptiveIs(bool a) {
+        if (a) throw PermissionException("manager has no real time ratio");
+    }
+    virtual unsigned int    virtualManagerNew(Ptr<Activity::Manager> am, 
+                                              unsigned int dilation, Time offset) {
+        throw PermissionException("manager cannot drive virtual managers");
+    }
+    virtual void            virtualManagerDel(Ptr<Activity::Manager> am) {
+        throw PermissionException("manager cannot drive virtual managers");
+    }
     virtual void            nowIs(Time t) = 0;
 
     // Constructor/Destructor
@@ -8,17 +8,23 @@
  */
 
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 #include <iostream>
 #include <map>
 #include <vector>
 #include <deque>
 #include <sys/time.h>
+#include <time.h>
+#include <errno.h>
 #include <limits.h>
+#include <algorithm>
 
 #include "Log.h"
 #include "Exception.h"
 #include "Activity.h"
 #include "ActivityImpl.h"
+#include "Simulation.h"
 
 using namespace std;
 
@@ -30,25 +36,118 @@ ostream& operator<<(ostream &s, Time t)
     return s << "(" << tv.tv_sec << " sec " << tv.tv_usec << " usec)";
 }
 
+/*
+ * Time(const int64_t &) takes these by reference, they need storage
+ */
+const int64_t Time::NEVER;
+const int64_t Time::MIN;
+
+/**
+ * name:
+ *
+ * anonymous activities get a name made up from their handle,
+ * built only when somebody asks for it
+ */
+
+string
+Activity::name() const
+{
+    char buf[32];
+
+    if (!name_.empty()) {
+        return name_;
+    }
+    snprintf(buf, sizeof(buf), "activity %u", handle_);
+    return buf;
+}
+
 namespace ActivityImpl {
 
-const Time Activity::Never = Time(DBL_MAX);
+const Time Activity::Never = Time(Time::NEVER);
 
 Log logActivity("ACTIVITY");
 
+#ifdef ACTIVITY_PROFILE
+/*
+ * clock for the execution profile, not slewed by NTP
+ */
+static Time
+profileClock()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return Time((int64_t)ts.tv_sec * Time::SEC_TO_NANO + ts.tv_nsec);
+}
+
+static void
+profileIs(Activity::Profile *profile, Time elapsed, unsigned int notifiees)
+{
+    profile->invocations++;
+    profile->notifiees += notifiees;
+    profile->total += elapsed;
+    if (elapsed > profile->max) {
+        profile->max = elapsed;
+    }
+}
+#endif
+
 /**
  * execute:
  *
+ * dispatch the notifiees, keeping the execution profile when
+ * built with ACTIVITY_PROFILE
+ */
+
+void
+ActivityImpl::execute()
+{
+    if (manager_->trace_) {
+        manager_->traceRecordIs(handle(), lastNotifiee_.empty() ? 
+                                ManagerImpl::TraceTimeout : ManagerImpl::TraceNotification);
+    }
+#ifdef ACTIVITY_PROFILE
+    Time            start = profileClock();
+    unsigned int    notifiees = dispatch();
+
+    /*
+     * look the record up after dispatching, a notifiee may label us
+     */
+    if (!profile_) {
+        string  key = label();
+        size_t  colon;
+
+        if (key.empty()) {
+            key = name();
+            colon = key.find(':');
+            if (colon != string::npos) {
+                key.erase(colon);
+            }
+        }
+        profile_ = manager_->profileRecord(key);
+    }
+    profileIs(profile_, profileClock() - start, notifiees);
+#else
+    dispatch();
+#endif
+}
+
+/**
+ * dispatch:
+ *
  * run lastNotifiee if available and return
  * -otherwise-
  * run timeoutNotifiee if available and return
+ *
+ * returns the number of notifiees run
  */
 
-void
-ActivityImpl::execute()
+unsigned int
+ActivityImpl::dispatch()
 {
     Ptr<RootNotifiee> root;
     vector<Ptr<RootNotifiee> >::iterator i;
+    unsigned int notifiees = 0;
 
     /*
      * go through all lastNotifiee_ and invoke handleNotification
@@ -57,6 +156,7 @@ ActivityImpl::execute()
         while (!lastNotifiee_.empty()) {
             i = lastNotifiee_.begin();
             root = (*i);
+            notifiees++;
             try {
                 root->handleNotification(this);
             } 
@@ -68,7 +168,7 @@ ActivityImpl::execute()
             }
             lastNotifiee_.erase(i);
         }
-        return;
+        return notifiees;
     }
 
     /*
@@ -85,6 +185,7 @@ ActivityImpl::execute()
     catch(...) {
         ACTIVITY_ERR("error detected when calling handleNotification\n");
     }
+    return 1;
 }
 
 void
@@ -116,29 +217,108 @@ ActivityImpl::nextTimeIs(Time t)
     if (nextTime() == t) {
         return;
     }
+    if (manager_->recording_) {
+        manager_->activityJournal(this);
+    }
     Activity::nextTimeIs(t);
     manager_->waitingQueueIs(this);
 }
 
+void
+ActivityImpl::timeoutNotifieeIs(Ptr<RootNotifiee> p)
+{
+    if (manager_->recording_) {
+        manager_->activityJournal(this);
+    }
+    Activity::timeoutNotifieeIs(p);
+}
+
+ManagerImpl::~ManagerImpl()
+{
+    ACTIVITY_TRACE("Destroyed\n");
+    traceClose();
+    for (unsigned int i = readyHead_; i < readyQueue_.size(); i++) {
+        if (readyQueue_[i].activity) {
+            readyQueue_[i].activity->deleteRef();
+        }
+    }
+    for (unsigned int i = 0; i < waitingQueue_.size(); i++) {
+        if (waitingQueue_[i].activity) {
+            waitingQueue_[i].activity->waitingIndex_ = ActivityImpl::NotWaiting;
+            waitingQueue_[i].activity->deleteRef();
+        }
+    }
+}
+
+Activity::Ptr 
+ManagerImpl::activity (Activity::Handle handle) const
+{
+    if (handle >= activity_.size()) {
+        return NULL;
+    }
+
+    return activity_[handle].value();
+}
+
 Activity::Ptr 
 ManagerImpl::activity (const string &name) const
 {
-    map<string, Activity::Ptr>::const_iterator t = activity_.find(name);
+    NameIndex::const_iterator t = nameIndex_.find(name);
 
-    if (t == activity_.end()) {
+    if (t == nameIndex_.end()) {
         return NULL;
     }
 
-    return (*t).second;
+    return activity((*t).second);
+}
+
+/**
+ * handleNew:
+ *
+ * find a slot for a new activity, handles of deleted activities
+ * are reused
+ */
+
+Activity::Handle
+ManagerImpl::handleNew()
+{
+    Activity::Handle handle;
+
+    if (!freeHandle_.empty()) {
+        handle = freeHandle_.back();
+        freeHandle_.pop_back();
+    } else {
+        handle = activity_.size();
+        activity_.push_back(NULL);
+    }
+
+    return handle;
 }
 
+/**
+ * activityNew:
+ *
+ * create an anonymous activity.  It is reachable through its handle
+ * only, so no name is built and the name index is left alone.
+ */
+
 Activity::Ptr 
-ManagerImpl::activityNew(const string &name)
+ManagerImpl::activityNew()
 {
-    Activity::Ptr activity;
+    Activity::Handle    handle = handleNew();
+    ActivityImpl::Ptr   activity = new ActivityImpl(string(), handle, this);
+
+    if (!activity) throw ResourceException();
+    activity_[handle] = activity;
+
+    return activity.value();
+}
 
-    map<string, Activity::Ptr>::const_iterator t = activity_.find(name);
-    if (t != activity_.end()) {
+Activity::Ptr 
+ManagerImpl::activityNew(const string &name)
+{
+    NameIndex::const_iterator t = nameIndex_.find(name);
+    if (t != nameIndex_.end()) {
         ACTIVITY_ERR("activity '%s' exists\n", name.c_str());
         /*
          * tell caller to use other name
@@ -146,39 +326,38 @@ ManagerImpl::activityNew(const string &name)
         throw NameInUseException(name);
     }
      
-    activity = new ActivityImpl(name, this);
+    Activity::Handle    handle = handleNew();
+    ActivityImpl::Ptr   activity = new ActivityImpl(name, handle, this);
+
     if (!activity) throw ResourceException();
-    activity_[name] = activity;
+    activity_[handle] = activity;
+    nameIndex_[name] = handle;
 
-    return activity;
+    return activity.value();
 }
 
 void 
-ManagerImpl::activityDel(const string &name)
+ManagerImpl::activityDel(Activity::Handle handle)
 {
-    Activity::Ptr                           activity;
-    map<string, Activity::Ptr>::iterator    t;
-   
-    t = activity_.find(name);
-    if (t == activity_.end()) {
-        ACTIVITY_ERR("activity '%s' does not exists\n", name.c_str());
+    ActivityImpl::Ptr activity;
+
+    if (handle >= activity_.size() || !activity_[handle]) {
+        ACTIVITY_ERR("activity handle %u does not exists\n", handle);
         return;
     }
-    activity = (*t).second;
+    activity = activity_[handle];
 
     switch (activity->status()) {
     case Activity::Free:
         break;
 
     case Activity::Waiting:
-        removeFromWaitingQueue(activity);
+        removeFromWaitingQueue(activity.value());
         break;
 
     case Activity::Ready:
-        removeFromReadyQueue(activity);
-        if (activity->nextTime() != Activity::Never) {
-            removeFromWaitingQueue(activity);
-        }
+        removeFromReadyQueue(activity.value());
+        removeFromWaitingQueue(activity.value());
         break;
 
     case Activity::Executing:
@@ -188,293 +367,3176 @@ ManagerImpl::activityDel(const string &name)
         throw PermissionException();
     }
 
-    activity_.erase(t);
+    NameIndex::iterator t = nameIndex_.find(activity->name());
+    if (t != nameIndex_.end() && (*t).second == handle) {
+        nameIndex_.erase(t);
+    }
+    activity->handleIs(Activity::NoHandle);
+    activity_[handle] = NULL;
+    freeHandle_.push_back(handle);
 }
 
-void
-ManagerImpl::removeFromReadyQueue (Activity::Ptr activity)
+void 
+ManagerImpl::activityDel(const string &name)
 {
-    vector<Activity::Ptr>::iterator i;
+    NameIndex::iterator t = nameIndex_.find(name);
 
-    for (i = readyQueue_.begin(); i < readyQueue_.end(); i++) {
-        if ((*i) == activity) {
-            readyQueue_.erase(i);
-            break;
-        }
+    if (t == nameIndex_.end()) {
+        ACTIVITY_ERR("activity '%s' does not exists\n", name.c_str());
+        return;
     }
+    activityDel((*t).second);
 }
 
-void
-ManagerImpl::removeFromWaitingQueue (Activity::Ptr activity)
+/**
+ * timerNew:
+ *
+ * run callback once at time t.  The callback is kept in a pooled
+ * record, no Activity or notifiee is involved.  A timer at Never
+ * is not scheduled at all.
+ */
+
+Activity::Timer
+ManagerImpl::timerNew(Time t, const Activity::Callback &callback)
 {
-    vector<Activity::Ptr>::iterator i;
+    if (t == Activity::Never || callback.empty()) {
+        return Activity::Timer();
+    }
+    return timerAdd(t, LocalSequence + ++sequence_, callback);
+}
 
-    for (i = waitingQueue_.begin(); i < waitingQueue_.end(); i++) {
-        if ((*i) == activity) {
-            waitingQueue_.erase(i);
-            return;
-        }
+/**
+ * timerNew:
+ *
+ * keyed version, the key takes the place of the sequence number
+ */
+
+Activity::Timer
+ManagerImpl::timerNew(Time t, unsigned long long key, 
+                      const Activity::Callback &callback)
+{
+    if (key >= LocalSequence) {
+        throw RangeException();
+    }
+    if (t == Activity::Never || callback.empty()) {
+        return Activity::Timer();
     }
+    return timerAdd(t, key, callback);
 }
 
+/**
+ * timerPost:
+ *
+ * a timer for another partition goes through the channel between
+ * the two, to be picked up at the next window barrier.  One due
+ * inside the running window would arrive out of order.  Links
+ * shorter than the lookahead are refused when they are set up, so
+ * this is a model posting on its own; the event that posted has
+ * already changed its partition and nothing can be made right
+ * again, the run stops here.
+ */
+
 void
-ManagerImpl::insertToWaitingQueue (Activity::Ptr activity)
+ManagerImpl::timerPost(Activity::Manager *to, Time t, unsigned long long key,
+                       const Activity::Callback &callback)
 {
-    /*
-     * insert it so its in sorted order
-     */
-    vector<Activity::Ptr>::iterator i;
+    ManagerImpl     *target = static_cast<ManagerImpl *>(to);
+    Channel::Message message;
 
-    /*
-     * if activity is in the waiting queue, remove it
-     */
-    if (activity->status() != Activity::Free) {
-        removeFromWaitingQueue(activity);
+    if (target == this || !parallel_) {
+        target->timerNew(t, key, callback);
+        return;
     }
 
-    /*
-     * set the status
-     */
-    if (activity->status() != Activity::Ready) {
-        activity->statusIs(Activity::Waiting);
+    if (t < windowEnd_) {
+        ACTIVITY_ERR("timer posted inside the window, lookahead violated\n");
+        abort();
     }
+    message.time        = t;
+    message.key         = key;
+    message.callback    = callback;
+    message.id          = ((unsigned long long)partitionIndex_ << 48) | ++messages_;
+    message.sent        = now_;
+    message.anti        = false;
+    parallel_->channel(partitionIndex_, target->partitionIndex_)->messageAdd(message);
 
     /*
-     * optimization case, where we need to put things on the back
+     * a speculative post may have to be taken back
      */
-    if (waitingQueue_.size() > 0) {
-        if (waitingQueue_.back()->nextTime() <= activity->nextTime()) {
-            waitingQueue_.push_back(activity);
-            return;
-        }
-    }
+    if (recording_) {
+        Sent sent;
 
-    for (i = waitingQueue_.begin(); i < waitingQueue_.end(); i++) {
-        Activity::Ptr act;
-        act = (*i);
-        if (activity->nextTime() < act->nextTime()) {
-            break;
-        }
+        sent.time   = now_;
+        sent.to     = target->partitionIndex_;
+        sent.id     = message.id;
+        sent_.push_back(sent);
     }
-    waitingQueue_.insert(i, activity);
 }
 
-void
-ManagerImpl::insertToReadyQueue (Ptr<Activity> activity)
+Activity::Timer
+ManagerImpl::timerAdd(Time t, unsigned long long sequence, 
+                      const Activity::Callback &callback)
 {
-    activity->statusIs(Activity::Ready);
-    readyQueue_.push_back(activity);
-}
+    WaitingEntry    entry;
+    unsigned int    index;
 
-void
-ManagerImpl::reschedule()
-{
-    vector<Activity::Ptr>::iterator i;
     /*
-     * go through wait queue and move it to  ready queue
-     * if its time to run the activity
+     * a slot freed by a speculative step may be brought back by a
+     * rollback, a timer that is not journaled stays out of them
      */
-    for (i = waitingQueue_.begin(); i < waitingQueue_.end(); i++) {
-        Activity::Ptr activity;
-
-        activity    = (*i);
-
-        /*
-         * if activity is currently in ready queue, skip
-         */
-        if (activity->status() == Activity::Ready) {
-            continue;
-        }
-
-        /*
-         * move it to active queue if its due
-         */
-        if (activity->nextTime() <= now()) {
-            waitingQueue_.erase(i);
-            insertToReadyQueue(activity);
+    if (speculative_ && !recording_) {
+        if (freeCommitted_ > 0) {
+            index = freeTimer_[--freeCommitted_];
+            freeTimer_.erase(freeTimer_.begin() + freeCommitted_);
+        } else {
+            index = timer_.size();
         }
-
-        /*
-         * since this is sorted order, we can break right away
-         * if time is greater than now
-         */
-        if (activity->nextTime() > now()) {
-            break;
+    } else if (!freeTimer_.empty()) {
+        index = freeTimer_.back();
+        freeTimer_.pop_back();
+        if (freeCommitted_ > freeTimer_.size()) {
+            freeCommitted_ = freeTimer_.size();
         }
+    } else {
+        index = timer_.size();
+    }
+    if (index == timer_.size()) {
+        timer_.push_back(TimerRecord());
+        timer_.back().generation = 0;
+        timer_.back().issued = 0;
+        timer_.back().waiting = false;
+    }
+    if (recording_) {
+        timerJournal(UndoRecord::TimerAdd, index);
     }
+    timer_[index].callback = callback;
+    timer_[index].waiting = true;
+    timer_[index].time = t;
+    timer_[index].sequence = sequence;
+
+    entry.time          = t;
+    entry.sequence      = sequence;
+    entry.activity      = NULL;
+    entry.timer         = index;
+    entry.generation    = timer_[index].generation;
+    waitingQueueAdd(entry);
+
+    return Activity::Timer(index, entry.generation);
 }
 
-void
-ManagerImpl::runActivityFromThread(Ptr<Activity> activity)
-{
-    activity->statusIs(Activity::Executing);
-}
+/**
+ * timerDel:
+ *
+ * cancel a pending timer.  Its queue entry stays behind as a
+ * tombstone; fired or cancelled timers are ignored.
+ */
 
 void
-ManagerImpl::runActivity(Ptr<Activity> activity)
+ManagerImpl::timerDel(Activity::Timer timer)
 {
-    runActivityFromThread(activity);
+    if (!timerPending(timer)) {
+        return;
+    }
+    if (recording_) {
+        timerJournal(UndoRecord::TimerRetire, timer.index());
+    }
+    timerRetire(timer);
 }
 
+/**
+ * timerRetire:
+ *
+ * free the record of a pending timer.  Generations are never handed
+ * out twice, a tombstone cannot come back to life even when a
+ * rollback puts an older generation back.
+ */
+
 void
-ManagerImpl::reschedule (Ptr<Activity> activity)
+ManagerImpl::timerRetire(Activity::Timer timer)
 {
-    if (activity->status() == Activity::Executing) {
-        if (activity->nextTime() == Activity::Never) {
-            activity->statusIs(Activity::Free);
-            return;
-        }
-
-        if (activity->nextTime() >= now()) {
-            activity->statusIs(Activity::Waiting);
-            return;
-        }
+    TimerRecord &record = timer_[timer.index()];
+
+    record.generation = ++record.issued;
+    record.callback.clear();
+    freeTimer_.push_back(timer.index());
+    if (record.waiting) {
+        record.waiting = false;
+        staleIs(stale_ + 1);
     }
 }
 
-void
-ManagerImpl::runReadyQueue()
+bool
+ManagerImpl::timerPending(Activity::Timer timer) const
 {
-    while (!readyQueue_.empty()) {
-        Activity::Ptr   activity;
+    return timer.index() < timer_.size() &&
+           timer_[timer.index()].generation == timer.generation();
+}
 
-        activity = readyQueue_[0];
-        //readyQueue_.pop_front();
-        readyQueue_.erase(readyQueue_.begin());
+/**
+ * runTimer:
+ *
+ * the timer is retired before its callback runs, so the callback
+ * may schedule new timers or cancel its own.  timer_ is a deque,
+ * growing it leaves the running record where it is.
+ */
 
-        runActivity(activity);
-        reschedule(activity);
+void
+ManagerImpl::runTimer(Activity::Timer timer)
+{
+    if (!timerPending(timer)) {
+        return;
     }
-}
 
-Time
-ManagerImpl::nextTimeout () const
-{
-    /*
-     * go through wait queue, and find the one that timeout the first
-     */
-    if (waitingQueue_.empty()) {
-        return Activity::Never;
+    if (recording_) {
+        timerJournal(UndoRecord::TimerRetire, timer.index());
+    }
+    if (trace_) {
+        traceRecordIs(timer.index(), TraceTimer);
     }
 
-    return waitingQueue_[0]->nextTime();
+    TimerRecord &record = timer_[timer.index()];
+    record.generation = ++record.issued;
+    events_++;
+#ifdef ACTIVITY_PROFILE
+    Time start = profileClock();
+#endif
+    try {
+        record.callback();
+    }
+    catch (Exception &e) {
+        ACTIVITY_ERR("%s\n", e.what());
+    }
+    catch(...) {
+        ACTIVITY_ERR("error detected while running timer callback\n");
+    }
+#ifdef ACTIVITY_PROFILE
+    profileIs(profileRecord("timer"), profileClock() - start, 0);
+#endif
+    record.callback.clear();
+    freeTimer_.push_back(timer.index());
 }
 
-void
-ManagerImpl::waitingQueueIs(Ptr<Activity> act)
-{
-    insertToWaitingQueue(act);
-}
+/**
+ * removeFromReadyQueue:
+ *
+ * unlink in O(1): bump the activity's ticket so whatever it
+ * has in the ready queue is skipped when it reaches the front
+ */
 
 void
-ManagerImpl::readyQueueIs(Ptr<Activity> act)
+ManagerImpl::removeFromReadyQueue (Activity::Ptr activity)
 {
-    insertToReadyQueue(act);
+    static_cast<ActivityImpl *>(activity.value())->readyTicket_++;
 }
 
 /**
- * nowIs:
+ * removeFromWaitingQueue:
  *
- * set now_ to the given time.
- *
- * if running is false, change now_, and return
- * if running is true, change now_, and process
- * outstanding activity
+ * the activity's entry goes stale either way.  With lazy cancel it
+ * is left in the queue as a tombstone for reschedule (or compaction)
+ * to drop, otherwise it is unlinked right away.
  */
 
 void
-ManagerImpl::nowIs(Time t)
+ManagerImpl::removeFromWaitingQueue (Activity::Ptr activity)
 {
-    if (t == now()) return;
+    ActivityImpl *act = static_cast<ActivityImpl *>(activity.value());
 
-    if (!running()) {
-        now_ = t;
+    if (!act->waitingLive_) {
         return;
     }
+    act->waitingLive_ = false;
+    act->waitingGeneration_++;
 
-    while (now_ < t) {
-        reschedule();
-
-        /*
-         * if ready queue is none, advance in time
-         */
-        if (readyQueue_.size() == 0) {
-            if (nextTimeout() == Activity::Never) {
-                now_ = t;
-                break;
-            }
-
-            if (nextTimeout() < t) {
-                now_ = nextTimeout();
-            } else {
-                now_ = t;
-            }
-        }
-
-        runReadyQueue();
+    if (lazyCancel_) {
+        staleIs(stale_ + 1);
+        return;
     }
+    waitingQueueDel(act);
 }
 
-/**
- * nowIs:
- *
- * if not running, set now_ to t, set startTime_ to t,
- * and record current virtualTime, and return
- *
- * if running, then go into a loop and update now_, and 
- * call virtualManager->nowIs() (if virtualManager exists)
- * loop will terminate when time t has elapsed.
- */
+void
+ManagerImpl::insertToWaitingQueue (Activity::Ptr activity)
+{
+    WaitingEntry entry;
+
+    /*
+     * if activity is in the waiting queue, remove it
+     */
+    if (activity->status() != Activity::Free) {
+        removeFromWaitingQueue(activity);
+    }
+
+    /*
+     * set the status
+     */
+    if (activity->status() != Activity::Ready) {
+        activity->statusIs(Activity::Waiting);
+    }
+
+    /*
+     * an activity waiting forever never becomes due, don't queue it
+     */
+    if (activity->nextTime() == Activity::Never) {
+        return;
+    }
+
+    /*
+     * the sequence number keeps activities due at the same time
+     * in the order they were scheduled
+     */
+    entry.time          = activity->nextTime();
+    entry.sequence      = LocalSequence + ++sequence_;
+    entry.activity      = static_cast<ActivityImpl *>(activity.value());
+    entry.timer         = 0;
+    entry.generation    = entry.activity->waitingGeneration_;
+    waitingQueueAdd(entry);
+    entry.activity->waitingLive_ = true;
+    entry.activity->waitingSequence_ = entry.sequence;
+}
+
+/**
+ * stale:
+ *
+ * an entry is stale once its activity has been rescheduled or
+ * removed, or its timer has been cancelled
+ */
+
+bool
+ManagerImpl::stale (const WaitingEntry &entry) const
+{
+    if (entry.activity) {
+        return entry.generation != entry.activity->waitingGeneration_;
+    }
+    return !timerPending(Activity::Timer(entry.timer, entry.generation));
+}
+
+/**
+ * staleIs:
+ *
+ * compact the waiting queue when stale entries take up too much of it
+ */
+
+void
+ManagerImpl::staleIs (unsigned int stale)
+{
+    stale_ = stale;
+    if (stale_ >= CompactMin && 
+        stale_ * 100ULL >= waitingQueueSize() * (unsigned long long)CompactPercent) {
+        ACTIVITY_TRACE("compacting %u stale of %u entries\n", stale_, waitingQueueSize());
+        waitingQueueCompact();
+        stale_ = 0;
+    }
+}
+
+double
+ManagerImpl::staleRatio () const
+{
+    if (waitingQueueSize() == 0) {
+        return 0.0;
+    }
+    return (double)stale_ / waitingQueueSize();
+}
+
+/**
+ * lazyCancelIs:
+ *
+ * switching lazy cancel off compacts the queue first, eager
+ * removal needs exactly one entry per activity
+ */
+
+void
+ManagerImpl::lazyCancelIs (bool lazy)
+{
+    if (lazy == lazyCancel_) {
+        return;
+    }
+    if (!lazy) {
+        waitingQueueCompact();
+        stale_ = 0;
+    }
+    lazyCancel_ = lazy;
+}
+
+/**
+ * efficiency:
+ *
+ * share of the events run that were not rolled back
+ */
+
+double
+ManagerImpl::efficiency () const
+{
+    if (events_ == 0) {
+        return 1.0;
+    }
+    return (double)(events_ - eventsUndone_) / events_;
+}
+
+/**
+ * undoIs:
+ *
+ * journal a callback undoing a change the running event made
+ */
+
+void
+ManagerImpl::undoIs (const Activity::Callback &undo)
+{
+    UndoRecord record;
+
+    if (!recording_) {
+        return;
+    }
+    record.kind     = UndoRecord::Model;
+    record.callback = undo;
+    journal_.push_back(record);
+}
+
+/**
+ * activityJournal:
+ *
+ * journal the scheduling state of an activity about to change
+ */
+
+void
+ManagerImpl::activityJournal (ActivityImpl *activity)
+{
+    UndoRecord record;
+
+    record.kind     = UndoRecord::ActivityState;
+    record.activity = activity;
+    record.notifiee = activity->timeoutNotifiee_;
+    record.status   = activity->status();
+    record.waiting  = activity->waitingLive_;
+    record.time     = activity->nextTime();
+    record.sequence = activity->waitingSequence_;
+    journal_.push_back(record);
+}
+
+/**
+ * timerJournal:
+ *
+ * journal the record of timer index before it is added, popped to
+ * the ready queue, fired or cancelled
+ */
+
+void
+ManagerImpl::timerJournal (UndoRecord::Kind kind, unsigned int index)
+{
+    UndoRecord          record;
+    const TimerRecord   &timer = timer_[index];
+
+    record.kind         = kind;
+    record.timer        = index;
+    record.generation   = timer.generation;
+    record.waiting      = timer.waiting;
+    record.time         = timer.time;
+    record.sequence     = timer.sequence;
+    if (kind == UndoRecord::TimerRetire) {
+        record.callback = timer.callback;
+    }
+    journal_.push_back(record);
+}
+
+/**
+ * undo:
+ *
+ * put back the state saved in record.  Records are undone newest
+ * first, so the state they find is the one they left behind.  The
+ * waiting queue is restored by content: entries of the undone steps
+ * go stale and the entries they consumed are queued again with
+ * their original sequence numbers.
+ */
+
+void
+ManagerImpl::undo (UndoRecord &record)
+{
+    WaitingEntry entry;
+
+    switch (record.kind) {
+    case UndoRecord::Model:
+        record.callback();
+        return;
+
+    case UndoRecord::ActivityState: {
+        ActivityImpl *activity = record.activity.value();
+
+        if (activity->waitingLive_) {
+            activity->waitingLive_ = false;
+            staleIs(stale_ + 1);
+        }
+        activity->waitingGeneration_++;
+        activity->Activity::nextTimeIs(record.time);
+        activity->Activity::statusIs(record.status);
+        activity->timeoutNotifiee_ = record.notifiee;
+        if (!record.waiting) {
+            return;
+        }
+        entry.time          = record.time;
+        entry.sequence      = record.sequence;
+        entry.activity      = activity;
+        entry.timer         = 0;
+        entry.generation    = activity->waitingGeneration_;
+        waitingQueueAdd(entry);
+        activity->waitingLive_ = true;
+        activity->waitingSequence_ = record.sequence;
+        return;
+    }
+
+    case UndoRecord::TimerAdd:
+        timerRetire(Activity::Timer(record.timer, timer_[record.timer].generation));
+        return;
+
+    case UndoRecord::TimerPop:
+        break;
+
+    case UndoRecord::TimerRetire: {
+        TimerRecord &timer = timer_[record.timer];
+
+        /*
+         * take the record off the free list, usually its tail
+         */
+        for (unsigned int i = freeTimer_.size(); i-- > 0; ) {
+            if (freeTimer_[i] == record.timer) {
+                freeTimer_.erase(freeTimer_.begin() + i);
+                if (i < freeCommitted_) {
+                    freeCommitted_--;
+                }
+                break;
+            }
+        }
+        timer.generation    = record.generation;
+        timer.callback      = record.callback;
+        timer.time          = record.time;
+        timer.sequence      = record.sequence;
+        break;
+    }
+    }
+
+    /*
+     * a timer that was waiting goes back to the waiting queue.  A
+     * cancelled one may still have its tombstone there, which is
+     * live again; the duplicate entry is harmless, whichever runs
+     * second finds the timer retired.
+     */
+    TimerRecord &timer = timer_[record.timer];
+
+    timer.waiting = record.waiting;
+    if (!record.waiting) {
+        return;
+    }
+    entry.time          = record.time;
+    entry.sequence      = record.sequence;
+    entry.activity      = NULL;
+    entry.timer         = record.timer;
+    entry.generation    = record.generation;
+    waitingQueueAdd(entry);
+}
+
+/**
+ * stepIs:
+ *
+ * a speculative run starts a step, a step that left no trace is
+ * reused
+ */
+
+void
+ManagerImpl::stepIs ()
+{
+    Step step;
+
+    if (!step_.empty() && 
+        step_.back().journal == journal_.size() && 
+        step_.back().sent == sent_.size()) {
+        step_.back().time = now_;
+        return;
+    }
+    step.time       = now_;
+    step.journal    = journal_.size();
+    step.sent       = sent_.size();
+    step.events     = events_;
+    step_.push_back(step);
+}
+
+/**
+ * rollbackIs:
+ *
+ * a timer due at t has come in late: undo every step at or after t,
+ * cancel what they posted to other partitions and rewind the clock
+ * to the last step kept
+ */
+
+bool
+ManagerImpl::rollbackIs (Time t)
+{
+    unsigned int i = step_.size();
+
+    while (i > 0 && step_[i - 1].time >= t) {
+        i--;
+    }
+    if (i == step_.size()) {
+        if (now_ > t) {
+            now_ = step_.empty() ? windowNow_ : step_.back().time;
+        }
+        return false;
+    }
+
+    const Step step = step_[i];
+    while (journal_.size() > step.journal) {
+        undo(journal_.back());
+        journal_.pop_back();
+    }
+
+    for (unsigned int s = step.sent; s < sent_.size(); s++) {
+        Channel::Message anti;
+
+        anti.time   = t;
+        anti.key    = 0;
+        anti.id     = sent_[s].id;
+        anti.sent   = sent_[s].time;
+        anti.anti   = true;
+        messages_++;
+        parallel_->channel(partitionIndex_, sent_[s].to)->messageAdd(anti);
+    }
+    sent_.resize(step.sent);
+
+    if (events_ != step.events) {
+        rollbacks_++;
+        eventsUndone_ += events_ - step.events;
+    }
+    now_ = i > 0 ? step_[i - 1].time : windowNow_;
+    step_.resize(i);
+    return true;
+}
+
+/**
+ * fossilCollect:
+ *
+ * nothing before the GVT can be rolled back any more, drop its
+ * steps, journal and message records
+ */
+
+void
+ManagerImpl::fossilCollect (Time gvt)
+{
+    unsigned int i = 0;
+    unsigned int journal = journal_.size();
+    unsigned int sent = sent_.size();
+
+    while (i < step_.size() && step_[i].time < gvt) {
+        i++;
+    }
+    if (i < step_.size()) {
+        journal = step_[i].journal;
+        sent = step_[i].sent;
+    }
+    journal_.erase(journal_.begin(), journal_.begin() + journal);
+    sent_.erase(sent_.begin(), sent_.begin() + sent);
+    step_.erase(step_.begin(), step_.begin() + i);
+    for (unsigned int s = 0; s < step_.size(); s++) {
+        step_[s].journal -= journal;
+        step_[s].sent -= sent;
+    }
+
+    freeCommitted_ = freeTimer_.size();
+    for (InboundIndex::iterator in = inbound_.begin(); in != inbound_.end(); ) {
+        if ((*in).second.sent < gvt) {
+            inbound_.erase(in++);
+        } else {
+            ++in;
+        }
+    }
+}
+
+void
+ManagerImpl::waitingQueueAdd (const WaitingEntry &entry)
+{
+    if (entry.activity) {
+        entry.activity->newRef();
+    }
+    waitingQueue_.push_back(entry);
+    heapUp(waitingQueue_, waitingQueue_.size() - 1);
+}
+
+void
+ManagerImpl::waitingQueueDel (ActivityImpl *activity)
+{
+    if (activity->waitingIndex_ == ActivityImpl::NotWaiting) {
+        return;
+    }
+    waitingQueueRemove(activity->waitingIndex_);
+}
+
+bool
+ManagerImpl::waitingQueueHead (WaitingEntry &entry)
+{
+    if (waitingQueue_.empty()) {
+        return false;
+    }
+    entry = waitingQueue_[0];
+    return true;
+}
+
+void
+ManagerImpl::waitingQueuePop ()
+{
+    waitingQueueRemove(0);
+}
+
+unsigned int
+ManagerImpl::waitingQueueSize () const
+{
+    return waitingQueue_.size();
+}
+
+/**
+ * waitingQueueCompact:
+ *
+ * squeeze out the stale entries and rebuild the heap bottom up
+ */
+
+void
+ManagerImpl::waitingQueueCompact ()
+{
+    unsigned int kept = 0;
+
+    for (unsigned int i = 0; i < waitingQueue_.size(); i++) {
+        const WaitingEntry &entry = waitingQueue_[i];
+
+        if (stale(entry)) {
+            if (entry.activity) {
+                entry.activity->deleteRef();
+            }
+            continue;
+        }
+        waitingQueue_[kept++] = entry;
+    }
+    waitingQueue_.resize(kept);
+    heapMake(waitingQueue_);
+}
+
+static inline bool
+earlier (Time t1, unsigned long long s1, Time t2, unsigned long long s2)
+{
+    if (t1 != t2) {
+        return t1 < t2;
+    }
+    return s1 < s2;
+}
+
+/**
+ * heapPlace:
+ *
+ * store entry at heap position i and let the activity know where it is
+ */
+
+void
+ManagerImpl::heapPlace (vector<WaitingEntry> &heap, unsigned int i, 
+                        const WaitingEntry &entry)
+{
+    heap[i] = entry;
+    if (entry.activity) {
+        entry.activity->waitingIndex_ = i;
+    }
+}
+
+void
+ManagerImpl::heapUp (vector<WaitingEntry> &heap, unsigned int i)
+{
+    WaitingEntry entry = heap[i];
+
+    while (i > 0) {
+        unsigned int parent = (i - 1) / WaitingQueueArity;
+        const WaitingEntry &p = heap[parent];
+
+        if (!earlier(entry.time, entry.sequence, p.time, p.sequence)) {
+            break;
+        }
+        heapPlace(heap, i, p);
+        i = parent;
+    }
+    heapPlace(heap, i, entry);
+}
+
+void
+ManagerImpl::heapDown (vector<WaitingEntry> &heap, unsigned int i)
+{
+    WaitingEntry entry = heap[i];
+    unsigned int size = heap.size();
+
+    do {
+        unsigned int first = i * WaitingQueueArity + 1;
+        unsigned int last  = first + WaitingQueueArity;
+        unsigned int child = first;
+
+        if (first >= size) {
+            break;
+        }
+        if (last > size) {
+            last = size;
+        }
+
+        /*
+         * pick the earliest child
+         */
+        for (unsigned int c = first + 1; c < last; c++) {
+            const WaitingEntry &e = heap[c];
+            if (earlier(e.time, e.sequence, heap[child].time, heap[child].sequence)) {
+                child = c;
+            }
+        }
+
+        const WaitingEntry &e = heap[child];
+        if (!earlier(e.time, e.sequence, entry.time, entry.sequence)) {
+            break;
+        }
+        heapPlace(heap, i, e);
+        i = child;
+    } while (1);
+    heapPlace(heap, i, entry);
+}
+
+/**
+ * heapMake:
+ *
+ * restore the heap order of an unordered vector bottom up
+ */
+
+void
+ManagerImpl::heapMake (vector<WaitingEntry> &heap)
+{
+    unsigned int size = heap.size();
+
+    if (size > 1) {
+        for (unsigned int i = (size - 2) / WaitingQueueArity + 1; i-- > 0; ) {
+            heapDown(heap, i);
+        }
+    }
+    for (unsigned int i = 0; i < size; i++) {
+        heapPlace(heap, i, heap[i]);
+    }
+}
+
+/**
+ * heapRemove:
+ *
+ * remove heap position i, fill the hole with the last entry and
+ * restore the heap order around it
+ */
+
+ManagerImpl::WaitingEntry
+ManagerImpl::heapRemove (vector<WaitingEntry> &heap, unsigned int i)
+{
+    WaitingEntry entry = heap[i];
+    WaitingEntry last = heap.back();
+
+    heap.pop_back();
+    if (i < heap.size()) {
+        heapPlace(heap, i, last);
+        if (i > 0 && earlier(last.time, last.sequence,
+                             heap[(i - 1) / WaitingQueueArity].time,
+                             heap[(i - 1) / WaitingQueueArity].sequence)) {
+            heapUp(heap, i);
+        } else {
+            heapDown(heap, i);
+        }
+    }
+    return entry;
+}
+
+void
+ManagerImpl::waitingQueueRemove (unsigned int i)
+{
+    ActivityImpl *act = heapRemove(waitingQueue_, i).activity;
+
+    if (act) {
+        act->waitingIndex_ = ActivityImpl::NotWaiting;
+        act->deleteRef();
+    }
+}
+
+void
+ManagerImpl::insertToReadyQueue (Ptr<Activity> activity)
+{
+    ReadyEntry entry;
+
+    activity->statusIs(Activity::Ready);
+    entry.activity  = static_cast<ActivityImpl *>(activity.value());
+    entry.ticket    = entry.activity->readyTicket_;
+    entry.activity->newRef();
+    readyQueue_.push_back(entry);
+}
+
+void
+ManagerImpl::reschedule()
+{
+    WaitingEntry            entry;
+    vector<WaitingEntry>    deferred;
+
+    /*
+     * pop every due activity off the waiting queue and move it to
+     * the ready queue, earliest first
+     */
+    while (waitingQueueHead(entry)) {
+        /*
+         * tombstones are dropped as soon as they surface
+         */
+        if (stale(entry)) {
+            waitingQueuePop();
+            stale_--;
+            continue;
+        }
+
+        /*
+         * the queue is ordered, we can stop right away
+         * if the earliest time is greater than now
+         */
+        if (entry.time > now()) {
+            break;
+        }
+
+        /*
+         * a timer goes straight to the ready queue
+         */
+        if (!entry.activity) {
+            ReadyEntry ready;
+
+            waitingQueuePop();
+            if (recording_) {
+                timerJournal(UndoRecord::TimerPop, entry.timer);
+            }
+            timer_[entry.timer].waiting = false;
+            ready.activity  = NULL;
+            ready.ticket    = 0;
+            ready.timer     = Activity::Timer(entry.timer, entry.generation);
+            readyQueue_.push_back(ready);
+            continue;
+        }
+
+        Activity::Ptr activity = entry.activity;
+
+        /*
+         * if activity is currently in ready queue, keep it waiting
+         * and put it back once we are done
+         */
+        if (activity->status() == Activity::Ready) {
+            entry.activity->newRef();
+            deferred.push_back(entry);
+            waitingQueuePop();
+            continue;
+        }
+
+        if (recording_) {
+            activityJournal(entry.activity);
+        }
+        waitingQueuePop();
+        entry.activity->waitingLive_ = false;
+        insertToReadyQueue(activity);
+    }
+
+    for (unsigned int i = 0; i < deferred.size(); i++) {
+        waitingQueueAdd(deferred[i]);
+        deferred[i].activity->deleteRef();
+    }
+}
+
+void
+ManagerImpl::runActivityFromThread(Ptr<Activity> activity)
+{
+    activity->statusIs(Activity::Executing);
+}
+
+void
+ManagerImpl::runActivity(Ptr<Activity> activity)
+{
+    runActivityFromThread(activity);
+}
+
+void
+ManagerImpl::reschedule (Ptr<Activity> activity)
+{
+    if (activity->status() == Activity::Executing) {
+        if (activity->nextTime() == Activity::Never) {
+            activity->statusIs(Activity::Free);
+            return;
+        }
+
+        if (activity->nextTime() >= now()) {
+            activity->statusIs(Activity::Waiting);
+            return;
+        }
+    }
+}
+
+/**
+ * runReadyQueue:
+ *
+ * run the batch of everything due at now_, including what becomes
+ * ready while it runs.  The entries stay in place until the batch
+ * is done, so the queue keeps its storage from one batch to the next.
+ */
+
+void
+ManagerImpl::runReadyQueue()
+{
+    unsigned int batch = 0;
+
+    while (readyHead_ < readyQueue_.size()) {
+        ReadyEntry      entry = readyQueue_[readyHead_++];
+
+        if (!entry.activity) {
+            batch++;
+            runTimer(entry.timer);
+            continue;
+        }
+
+        Activity::Ptr   activity = entry.activity;
+
+        entry.activity->deleteRef();
+
+        /*
+         * skip entries unlinked by removeFromReadyQueue
+         */
+        if (entry.ticket != entry.activity->readyTicket_) {
+            continue;
+        }
+
+        batch++;
+        events_++;
+        runActivity(activity);
+        reschedule(activity);
+    }
+    readyQueue_.clear();
+    readyHead_ = 0;
+    if (batch) {
+        batchIs(batch);
+    }
+}
+
+/**
+ * batchIs:
+ *
+ * account for a batch of events run at one timestamp, bucket i
+ * counts batches of 2^i up to 2^(i+1) - 1 events
+ */
+
+void
+ManagerImpl::batchIs(unsigned int events)
+{
+    unsigned int bucket = 0;
+
+    while (events > 1 && bucket < BatchBuckets - 1) {
+        events >>= 1;
+        bucket++;
+    }
+    batchHistogram_[bucket]++;
+}
+
+const char ManagerImpl::TraceMagic[8] = { 'A', 'C', 'T', 'T', 'R', 'C', '1', 0 };
+
+static void
+varintPut(FILE *file, unsigned long long v)
+{
+    while (v >= 0x80) {
+        putc((int)(v & 0x7f) | 0x80, file);
+        v >>= 7;
+    }
+    putc((int)v, file);
+}
+
+static bool
+varintGet(FILE *file, unsigned long long &v)
+{
+    int c;
+
+    v = 0;
+    for (unsigned int shift = 0; shift < 64; shift += 7) {
+        if ((c = getc(file)) == EOF) {
+            return false;
+        }
+        v |= (unsigned long long)(c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * traceIs:
+ *
+ * record every event run from now on to file, an empty name
+ * stops recording
+ */
+
+void
+ManagerImpl::traceIs(const string &file)
+{
+    traceClose();
+    if (file.empty()) {
+        return;
+    }
+    if (!(trace_ = fopen(file.c_str(), "wb"))) {
+        throw ResourceException();
+    }
+    fwrite(TraceMagic, sizeof(TraceMagic), 1, trace_);
+    replay_ = false;
+    traceTime_ = Time();
+    traceId_ = 0;
+    traceEvents_ = 0;
+}
+
+/**
+ * replayIs:
+ *
+ * check every event run from now on against the trace in file,
+ * only those at from up to to count.  An empty name stops checking.
+ */
+
+void
+ManagerImpl::replayIs(const string &file, Time from, Time to)
+{
+    char magic[sizeof(TraceMagic)];
+
+    traceClose();
+    if (file.empty()) {
+        return;
+    }
+    if (!(trace_ = fopen(file.c_str(), "rb"))) {
+        throw ResourceException();
+    }
+    if (fread(magic, sizeof(magic), 1, trace_) != 1 || 
+        memcmp(magic, TraceMagic, sizeof(magic))) {
+        fclose(trace_);
+        trace_ = NULL;
+        throw RangeException();
+    }
+    replay_ = true;
+    replayFrom_ = from;
+    replayTo_ = to;
+    traceTime_ = Time();
+    traceId_ = 0;
+    traceEvents_ = 0;
+    replayMismatches_ = 0;
+}
+
+/**
+ * traceRecord:
+ *
+ * read the next record of a replayed trace, false at its end
+ */
+
+bool
+ManagerImpl::traceRecord(Time &time, unsigned int &id, TraceKind &kind)
+{
+    unsigned long long delta, word;
+    unsigned int zigzag;
+
+    if (!varintGet(trace_, delta) || !varintGet(trace_, word)) {
+        return false;
+    }
+    zigzag = (unsigned int)(word >> 2);
+    traceTime_ = traceTime_ + Time((int64_t)delta);
+    traceId_ += (zigzag >> 1) ^ -(zigzag & 1);
+    time = traceTime_;
+    id = traceId_;
+    kind = (TraceKind)(word & 3);
+    return true;
+}
+
+/**
+ * traceRecordIs:
+ *
+ * an event is about to run: append it to the trace, or check it
+ * against the next one of the replayed trace
+ */
+
+void
+ManagerImpl::traceRecordIs(unsigned int id, TraceKind kind)
+{
+    static const char *kindName[] = { "timeout", "notification", "timer" };
+
+    if (!replay_) {
+        int             delta = (int)(id - traceId_);
+        unsigned int    zigzag = ((unsigned int)delta << 1) ^ (unsigned int)(delta >> 31);
+
+        varintPut(trace_, (unsigned long long)(now_ - traceTime_).value());
+        varintPut(trace_, (unsigned long long)zigzag << 2 | kind);
+        traceTime_ = now_;
+        traceId_ = id;
+        traceEvents_++;
+        return;
+    }
+
+    if (replayMismatches_ || now_ < replayFrom_ || now_ > replayTo_) {
+        return;
+    }
+
+    Time        time;
+    unsigned    recorded;
+    TraceKind   recordedKind;
+    do {
+        if (!traceRecord(time, recorded, recordedKind) || time > replayTo_) {
+            ACTIVITY_ERR("event %llu at %lld, %s %u, is past the end of the trace\n",
+                         traceEvents_, (long long)now_.value(), kindName[kind], id);
+            replayMismatches_++;
+            return;
+        }
+    } while (time < replayFrom_);
+
+    if (time != now_ || recorded != id || recordedKind != kind) {
+        ACTIVITY_ERR("event %llu differs from the trace: ran %s %u at %lld, "
+                     "traced %s %u at %lld\n", traceEvents_, 
+                     kindName[kind], id, (long long)now_.value(), 
+                     kindName[recordedKind], recorded, (long long)time.value());
+        replayMismatches_++;
+        return;
+    }
+    traceEvents_++;
+}
+
+/**
+ * traceClose:
+ *
+ * finish a recording, or a replay: trace events in the window the
+ * run never got to are a mismatch too
+ */
+
+void
+ManagerImpl::traceClose()
+{
+    if (!trace_) {
+        return;
+    }
+    if (replay_ && !replayMismatches_) {
+        Time        time;
+        unsigned    id;
+        TraceKind   kind;
+
+        while (traceRecord(time, id, kind) && time <= replayTo_) {
+            if (time >= replayFrom_) {
+                ACTIVITY_ERR("run ended before the trace, %llu events in\n", 
+                             traceEvents_);
+                replayMismatches_++;
+                break;
+            }
+        }
+    }
+    fclose(trace_);
+    trace_ = NULL;
+}
+
+/**
+ * snapshotIs:
+ *
+ * save the clock and every pending activity, in the order they were
+ * scheduled.  Nothing may be due at now and no unkeyed timer may be
+ * pending, a callback cannot be saved.
+ */
+
+void
+ManagerImpl::snapshotIs(Ptr<Activity::Checkpoint> checkpoint)
+{
+    vector<pair<unsigned long long, ActivityImpl *> > pending;
+
+    if (recording_ || readyHead_ != readyQueue_.size()) {
+        throw PermissionException("cannot checkpoint in the middle of a batch");
+    }
+    for (unsigned int i = 0; i < timer_.size(); i++) {
+        if (!timer_[i].callback.empty() && timer_[i].sequence >= LocalSequence) {
+            throw PermissionException("cannot checkpoint a pending unkeyed timer");
+        }
+    }
+    for (unsigned int i = 0; i < activity_.size(); i++) {
+        if (activity_[i] && activity_[i]->waitingLive_) {
+            pending.push_back(make_pair(activity_[i]->waitingSequence_, 
+                                        activity_[i].value()));
+        }
+    }
+    sort(pending.begin(), pending.end());
+
+    checkpoint->timeIs(now_);
+    checkpoint->integerIs(sequence_);
+    checkpoint->integerIs(pending.size());
+    for (unsigned int i = 0; i < pending.size(); i++) {
+        checkpoint->integerIs(pending[i].second->handle());
+        checkpoint->timeIs(pending[i].second->nextTime());
+        checkpoint->integerIs(pending[i].first - LocalSequence);
+    }
+}
+
+/**
+ * restoreIs:
+ *
+ * put back the clock and the pending activities of a checkpoint, in
+ * place of everything scheduled.  The manager must have no timer.
+ */
+
+void
+ManagerImpl::restoreIs(Ptr<Activity::Checkpoint> checkpoint)
+{
+    if (recording_ || readyHead_ != readyQueue_.size()) {
+        throw PermissionException("cannot restore in the middle of a batch");
+    }
+    for (unsigned int i = 0; i < timer_.size(); i++) {
+        if (!timer_[i].callback.empty()) {
+            throw PermissionException("cannot restore over a pending timer");
+        }
+    }
+    for (unsigned int i = 0; i < activity_.size(); i++) {
+        if (activity_[i] && activity_[i]->waitingLive_) {
+            removeFromWaitingQueue(activity_[i].value());
+            activity_[i]->Activity::nextTimeIs(Activity::Never);
+        }
+    }
+
+    now_ = checkpoint->time();
+    unsigned long long sequence = checkpoint->integer();
+    unsigned long long pending = checkpoint->integer();
+
+    for (unsigned long long i = 0; i < pending; i++) {
+        Activity::Handle handle = checkpoint->integer();
+        Time time = checkpoint->time();
+        WaitingEntry entry;
+
+        entry.activity = static_cast<ActivityImpl *>(checkpoint->activity(handle).value());
+        if (!entry.activity || entry.activity->manager_ != this || time == Activity::Never) {
+            throw RangeException();
+        }
+        entry.activity->Activity::nextTimeIs(time);
+        entry.time          = time;
+        entry.sequence      = LocalSequence + checkpoint->integer();
+        entry.timer         = 0;
+        entry.generation    = entry.activity->waitingGeneration_;
+        waitingQueueAdd(entry);
+        entry.activity->waitingLive_ = true;
+        entry.activity->waitingSequence_ = entry.sequence;
+    }
+    sequence_ = sequence;
+}
+
+#ifdef ACTIVITY_PROFILE
+Activity::Profile *
+ManagerImpl::profileRecord(const string &key)
+{
+    Activity::Profile &profile = profile_[key];
+
+    profile.key = key;
+    return &profile;
+}
+#endif
+
+/*
+ * most expensive first
+ */
+static bool
+costlier(const Activity::Profile &p1, const Activity::Profile &p2)
+{
+    return p1.total > p2.total || (p1.total == p2.total && p1.key < p2.key);
+}
+
+vector<Activity::Profile>
+ManagerImpl::profile() const
+{
+    vector<Activity::Profile> profile;
+
+#ifdef ACTIVITY_PROFILE
+    for (ProfileIndex::const_iterator i = profile_.begin(); i != profile_.end(); i++) {
+        profile.push_back(i->second);
+    }
+#endif
+    sort(profile.begin(), profile.end(), costlier);
+    return profile;
+}
+
+unsigned long long
+ManagerImpl::batchHistogram(unsigned int bucket) const
+{
+    if (bucket >= BatchBuckets) {
+        throw RangeException();
+    }
+    return batchHistogram_[bucket];
+}
+
+Time
+ManagerImpl::nextTimeout () const
+{
+    /*
+     * go through wait queue, and find the one that timeout the first
+     */
+    if (waitingQueue_.empty()) {
+        return Activity::Never;
+    }
+
+    return waitingQueue_[0].time;
+}
+
+void
+ManagerImpl::waitingQueueIs(Ptr<Activity> act)
+{
+    insertToWaitingQueue(act);
+}
+
+void
+ManagerImpl::readyQueueIs(Ptr<Activity> act)
+{
+    insertToReadyQueue(act);
+}
+
+/**
+ * nowIs:
+ *
+ * set now_ to the given time.
+ *
+ * if running is false, change now_, and return
+ * if running is true, change now_, and process
+ * outstanding activity
+ */
+
+void
+ManagerImpl::nowIs(Time t)
+{
+    if (t == now()) return;
+
+    if (!running()) {
+        now_ = t;
+        return;
+    }
+
+    recording_ = speculative_;
+    while (now_ < t) {
+        if (recording_) {
+            stepIs();
+        }
+        reschedule();
+
+        /*
+         * nothing due, advance to the next timestamp before
+         * collecting its batch
+         */
+        if (readyHead_ == readyQueue_.size()) {
+            Time next = nextTimeout();
+
+            now_ = next < t ? next : t;
+            continue;
+        }
+
+        runReadyQueue();
+    }
+    recording_ = false;
+}
+
+const int64_t RealTimeManagerImpl::SpinDefault;
+const int64_t RealTimeManagerImpl::LagThresholdDefault;
+const int64_t RealTimeManagerImpl::AdaptPeriod;
+
+/**
+ * monotonic:
+ *
+ * CLOCK_MONOTONIC in nanosecond, immune to wall clock adjustments
+ */
+
+Time
+RealTimeManagerImpl::monotonic()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return Time((int64_t)ts.tv_sec * Time::SEC_TO_NANO + ts.tv_nsec);
+}
+
+/**
+ * virtualTime:
+ *
+ * the domain's virtual time at real time t
+ */
+
+Time
+RealTimeManagerImpl::virtualTime(const Domain &domain, Time t) const
+{
+    if (t <= domain.anchor) {
+        return domain.anchorVirtual;
+    }
+    return domain.anchorVirtual + 
+           Time((t - domain.anchor).value() / domain.ratio.value());
+}
+
+/**
+ * realTime:
+ *
+ * the real time at which the domain reaches virtualTime
+ */
+
+Time
+RealTimeManagerImpl::realTime(const Domain &domain, Time virtualTime) const
+{
+    Time    delta = virtualTime - domain.anchorVirtual;
+    int64_t scale = domain.ratio.value();
+
+    if (virtualTime == Activity::Never || delta.value() > Time::NEVER / scale) {
+        return Activity::Never;
+    }
+    if (delta.value() < 0) {
+        return domain.anchor;
+    }
+    return domain.anchor + Time(delta.value() * scale);
+}
+
+/**
+ * waitUntil:
+ *
+ * block until real time t, sleeping on the monotonic clock and
+ * spinning for the final spin_ only
+ */
+
+void
+RealTimeManagerImpl::waitUntil(Time t)
+{
+    Time deadline = startClock_ + (t - startTime_);
+    Time wake = deadline - spin_;
+
+    if (wake > monotonic()) {
+        struct timespec ts;
+
+        ts.tv_sec = wake.value() / Time::SEC_TO_NANO;
+        ts.tv_nsec = wake.value() % Time::SEC_TO_NANO;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+            /* interrupted by a signal, go back to sleep */
+        }
+    }
+    while (monotonic() < deadline) {
+        /* spin */
+    }
+}
+
+unsigned long long
+RealTimeManagerImpl::lagHistogram(unsigned int bucket) const
+{
+    if (bucket >= LagBuckets) {
+        throw RangeException();
+    }
+    return lagHistogram_[bucket];
+}
+
+/**
+ * lagIs:
+ *
+ * account for a round that started lag after its deadline
+ */
+
+void
+RealTimeManagerImpl::lagIs(Time lag)
+{
+    unsigned int        bucket = 0;
+    unsigned long long  usec = lag.value() / Time::USEC_TO_NANO;
+
+    while (usec && bucket < LagBuckets - 1) {
+        usec >>= 1;
+        bucket++;
+    }
+    lagHistogram_[bucket]++;
+    if (lag > lagMax_) {
+        lagMax_ = lag;
+    }
+    if (lag > lagThreshold_) {
+        lagMisses_++;
+    }
+}
+
+void
+RealTimeManagerImpl::lagReset()
+{
+    lagMax_ = Time();
+    lagMisses_ = 0;
+    for (unsigned int i = 0; i < LagBuckets; i++) {
+        lagHistogram_[i] = 0;
+    }
+}
+
+RealTimeManagerImpl::Ratio
+RealTimeManagerImpl::ratio(unsigned int domain) const
+{
+    if (domain >= domain_.size()) {
+        throw RangeException();
+    }
+    return domain_[domain].ratio;
+}
+
+Ptr<Activity::Manager>
+RealTimeManagerImpl::virtualManager(unsigned int domain) const
+{
+    if (domain >= domain_.size()) {
+        return NULL;
+    }
+    return domain_[domain].manager.value();
+}
+
+/**
+ * domainStart:
+ *
+ * anchor the domain's clock: it holds still until offset after
+ * real time t, then moves from where it is
+ */
+
+void
+RealTimeManagerImpl::domainStart(Domain &domain, Time t)
+{
+    domain.anchor = t + domain.offset;
+    domain.anchorVirtual = domain.manager->now();
+    domain.calm = 0;
+    domain.hold = AdaptCalmPeriods;
+    periodReset(domain, t);
+}
+
+/**
+ * virtualManagerIs:
+ *
+ * make am domain 0 at the current ratio, a NULL am removes domain 0
+ */
+
+void
+RealTimeManagerImpl::virtualManagerIs(Ptr<Activity::Manager> am)
+{
+    Ptr<ManagerImpl> manager = dynamic_cast<ManagerImpl *>(am.value());
+
+    if (!manager) {
+        if (!domain_.empty()) {
+            virtualManagerDel(domain_[0].manager.value());
+        }
+        return;
+    }
+    if (domain_.empty()) {
+        virtualManagerNew(am, Ratio::Default, Time());
+        return;
+    }
+    domain_[0].manager = manager;
+    domainStart(domain_[0], running() ? clock() : now());
+    deadlineIs(0);
+}
+
+/**
+ * virtualManagerNew:
+ *
+ * add a clock domain, returns its index
+ */
+
+unsigned int
+RealTimeManagerImpl::virtualManagerNew(Ptr<Activity::Manager> am, unsigned int ratio,
+                                       Time offset)
+{
+    Domain domain;
+
+    domain.manager = dynamic_cast<ManagerImpl *>(am.value());
+    if (!domain.manager) {
+        throw RangeException();
+    }
+    domain.ratio = Ratio(ratio);
+    domain.offset = offset;
+    domain.deadline = Activity::Never;
+    domain.generation = 0;
+    domainStart(domain, running() ? clock() : now());
+    domain_.push_back(domain);
+    deadlineIs(domain_.size() - 1);
+
+    return domain_.size() - 1;
+}
+
+void
+RealTimeManagerImpl::virtualManagerDel(Ptr<Activity::Manager> am)
+{
+    for (unsigned int i = 0; i < domain_.size(); i++) {
+        if (domain_[i].manager.value() == am.value()) {
+            domain_.erase(domain_.begin() + i);
+            deadlineRebuild();
+            return;
+        }
+    }
+    ACTIVITY_ERR("not a virtual manager of this manager\n");
+}
+
+/**
+ * deadlineIs:
+ *
+ * requeue the domain if its next event moved
+ */
+
+void
+RealTimeManagerImpl::deadlineIs(unsigned int index)
+{
+    Domain      &domain = domain_[index];
+    Deadline    entry;
+
+    entry.time = realTime(domain, domain.manager->nextEvent());
+    if (entry.time == domain.deadline) {
+        return;
+    }
+    domain.deadline = entry.time;
+    domain.generation++;
+    if (entry.time == Activity::Never) {
+        return;
+    }
+    entry.domain = index;
+    entry.generation = domain.generation;
+    deadline_.push_back(entry);
+    push_heap(deadline_.begin(), deadline_.end());
+
+    /*
+     * every domain has one live entry at most, drop the
+     * stale ones before they pile up
+     */
+    if (deadline_.size() > 4 * domain_.size() + 16) {
+        deadlineRebuild();
+    }
+}
+
+/**
+ * deadlineHead:
+ *
+ * the earliest live entry, false if the queue is empty
+ */
+
+bool
+RealTimeManagerImpl::deadlineHead(Deadline &head)
+{
+    while (!deadline_.empty()) {
+        head = deadline_.front();
+        if (head.generation == domain_[head.domain].generation) {
+            return true;
+        }
+        pop_heap(deadline_.begin(), deadline_.end());
+        deadline_.pop_back();
+    }
+    return false;
+}
+
+void
+RealTimeManagerImpl::deadlineRebuild()
+{
+    deadline_.clear();
+    for (unsigned int i = 0; i < domain_.size(); i++) {
+        Deadline entry;
+
+        domain_[i].generation++;
+        if (domain_[i].deadline == Activity::Never) {
+            continue;
+        }
+        entry.time = domain_[i].deadline;
+        entry.domain = i;
+        entry.generation = domain_[i].generation;
+        deadline_.push_back(entry);
+    }
+    make_heap(deadline_.begin(), deadline_.end());
+}
+
+/**
+ * domainRun:
+ *
+ * bring the domain's virtual manager up to real time t
+ */
+
+void
+RealTimeManagerImpl::domainRun(unsigned int index, Time t)
+{
+    Domain  &domain = domain_[index];
+    Time    busy = monotonic();
+
+    domain.manager->nowIs(virtualTime(domain, t));
+    domain.busy += monotonic() - busy;
+}
+
+void
+RealTimeManagerImpl::ratioIs(Ratio ratio)
+{
+    if (domain_.empty()) {
+        throw RangeException();
+    }
+    ratioIs(0, ratio);
+}
+
+/**
+ * ratioIs:
+ *
+ * change a domain's ratio without moving its clock: the new ratio
+ * applies from the current point on
+ */
+
+void
+RealTimeManagerImpl::ratioIs(unsigned int index, Ratio ratio)
+{
+    if (index >= domain_.size()) {
+        throw RangeException();
+    }
+
+    Domain  &domain = domain_[index];
+    Time    current = running() ? clock() : now();
+
+    if (current > domain.anchor) {
+        domain.anchorVirtual = virtualTime(domain, current);
+        domain.anchor = current;
+    }
+    if (ratio.value() != domain.ratio.value()) {
+        ACTIVITY_INFO("domain %u ratio %u -> %u\n", index, 
+                      domain.ratio.value(), ratio.value());
+    }
+    domain.ratio = ratio;
+    deadlineIs(index);
+}
+
+void
+RealTimeManagerImpl::periodReset(Domain &domain, Time current)
+{
+    domain.busy = Time();
+    domain.missed = 0;
+    domain.periodStart = current;
+    domain.periodVirtualStart = virtualTime(domain, current);
+}
+
+/**
+ * adapt:
+ *
+ * called for a domain after each round it ran in while adaptive.
+ * AdaptMisses rounds in one period starting later than the threshold
+ * slow down at once, provided the virtual manager kept the thread
+ * busy for at least half of the period; a lone late round may be
+ * just a burst of events.  Speeding up waits for hold periods in a
+ * row with the virtual manager busy for less than 3/8 of the real
+ * time, and at most halves the ratio.  Every slow down doubles hold,
+ * so the ratio settles instead of flapping around the limit.
+ */
+
+void
+RealTimeManagerImpl::adapt(Domain &domain, Time current, Time lag)
+{
+    unsigned int index = &domain - &domain_[0];
+    unsigned int ratio = domain.ratio.value();
+
+    if (lag > lagThreshold_) {
+        domain.missed++;
+    }
+
+    /*
+     * late rounds while the virtual manager leaves the thread idle
+     * most of the time are the host's jitter, not something a lower
+     * speed would fix
+     */
+    if (domain.missed >= AdaptMisses && 
+        domain.busy.value() * 2 > (current - domain.periodStart).value()) {
+        if (ratio <= UINT_MAX / 2) {
+            ratioIs(index, Ratio(ratio * 2));
+        }
+        if (domain.hold < AdaptHoldMax) {
+            domain.hold *= 2;
+        }
+        domain.calm = 0;
+        periodReset(domain, current);
+        return;
+    }
+    if (current - domain.periodStart < Time(AdaptPeriod)) {
+        return;
+    }
+
+    /*
+     * real time the virtual manager needs per unit of virtual time,
+     * run at half of it to keep some headroom
+     */
+    Time   advanced = virtualTime(domain, current) - domain.periodVirtualStart;
+    double target = 1.0;
+    if (advanced > Time()) {
+        target = 2.0 * domain.busy.value() / advanced.value();
+    }
+    if (target < ratio * 0.75) {
+        domain.calm++;
+    } else {
+        domain.calm = 0;
+    }
+    if (domain.calm >= domain.hold) {
+        unsigned int r = target < 1.0 ? 1 : (unsigned int)target;
+
+        domain.calm = 0;
+        ratioIs(index, Ratio(r < ratio / 2 ? (ratio + 1) / 2 : r));
+    }
+    periodReset(domain, current);
+}
+
+/**
+ * nowIs:
+ *
+ * if not running, set now_ to t, set startTime_ to t, anchor
+ * every domain there, and return
+ *
+ * if running, then go into a loop and update now_, and run
+ * the virtual managers that are due, earliest first, until
+ * time t has elapsed; the last round brings every virtual
+ * manager up to t.  Between rounds the thread waits for the
+ * next event of any of them instead of polling.
+ */
+
+void 
+RealTimeManagerImpl::nowIs(Time t)
+{
+    if (t == now()) return;
+
+    if (!running()) {
+        startTime_ = t;
+        startClock_ = monotonic();
+        lagReset();
+        ManagerImpl::nowIs(t);
+        for (unsigned int i = 0; i < domain_.size(); i++) {
+            domainStart(domain_[i], t);
+            domain_[i].deadline = realTime(domain_[i], domain_[i].manager->nextEvent());
+        }
+        deadlineRebuild();
+        return;
+    }
+
+    Time            current, lag, next = Activity::Never;
+    Deadline        head;
+    int             late = -1;  // domain the last sleep was for
+    vector<bool>    ran;
+    do {
+        current = clock();
+        lag = Time();
+        if (next != Activity::Never) {
+            lag = current > next ? current - next : Time();
+            lagIs(lag);
+        }
+        if (current > t) {
+            current = t;
+        }
+        ManagerImpl::nowIs(current);
+
+        /*
+         * run the domains that are due in deadline order, or all
+         * of them in the last round
+         */
+        ran.assign(domain_.size(), false);
+        while (deadlineHead(head) && head.time <= current) {
+            pop_heap(deadline_.begin(), deadline_.end());
+            deadline_.pop_back();
+            domain_[head.domain].deadline = Activity::Never;
+            domainRun(head.domain, current);
+            ran[head.domain] = true;
+        }
+        for (unsigned int i = 0; i < domain_.size() && current == t; i++) {
+            if (!ran[i]) {
+                domainRun(i, current);
+            }
+        }
+        reschedule();
+        runReadyQueue();
+        if (current == t) {
+            break;
+        }
+
+        /*
+         * our own activities may have scheduled on any domain
+         */
+        for (unsigned int i = 0; i < domain_.size(); i++) {
+            deadlineIs(i);
+        }
+        if (adaptive_ && late >= 0 && late < (int)domain_.size() && ran[late]) {
+            adapt(domain_[late], current, lag);
+        }
+
+        /*
+         * sleep until whichever comes first: t, our next activity
+         * or the head of the deadline queue
+         */
+        next = nextEvent();
+        late = -1;
+        if (deadlineHead(head) && head.time < next) {
+            next = head.time;
+            late = head.domain;
+        }
+        if (t < next) {
+            next = t;
+            late = -1;
+        }
+        waitUntil(next);
+    } while(1);
+
+    /*
+     * requeue the domains the last round ran
+     */
+    for (unsigned int i = 0; i < domain_.size(); i++) {
+        deadlineIs(i);
+    }
+}
+
+WheelManagerImpl::WheelManagerImpl() :base_(0), size_(0)
+{
+    for (unsigned int level = 0; level < Levels; level++) {
+        for (unsigned int w = 0; w < MaskWords; w++) {
+            occupied_[level][w] = 0;
+        }
+    }
+}
+
+WheelManagerImpl::~WheelManagerImpl()
+{
+    ACTIVITY_TRACE("Destroyed\n");
+    for (unsigned int s = 0; s <= Due; s++) {
+        vector<WaitingEntry> &bucket = 
+            s == Overflow ? overflow_ : s == Due ? due_ : slot_[s];
+
+        for (unsigned int i = 0; i < bucket.size(); i++) {
+            if (bucket[i].activity) {
+                bucket[i].activity->waitingSlot_ = ActivityImpl::NotWaiting;
+                bucket[i].activity->deleteRef();
+            }
+        }
+    }
+}
+
+/**
+ * tick:
+ *
+ * the wheel turns in whole nanoseconds
+ */
+
+unsigned long long
+WheelManagerImpl::tick(Time t)
+{
+    if (t.value() <= 0) {
+        return 0;
+    }
+    return (unsigned long long)t.value();
+}
+
+/**
+ * heapAdd:
+ *
+ * file entry in the due or the overflow heap, both keep the
+ * activity's position so it can be taken out in O(log n)
+ */
+
+void
+WheelManagerImpl::heapAdd (vector<WaitingEntry> &heap, unsigned int slot, 
+                           const WaitingEntry &entry)
+{
+    if (entry.activity) {
+        entry.activity->waitingSlot_ = slot;
+    }
+    heap.push_back(entry);
+    heapUp(heap, heap.size() - 1);
+}
+
+/**
+ * slotAdd:
+ *
+ * file entry relative to base_:
+ * - at or before base_, it goes to the due heap
+ * - otherwise to the level of the highest digit it differs from base_
+ * - beyond the top level, it goes to the overflow heap
+ */
+
+void
+WheelManagerImpl::slotAdd (const WaitingEntry &entry)
+{
+    unsigned long long  t = tick(entry.time);
+    unsigned long long  diff = t ^ base_;
+    unsigned int        level, slot;
+
+    if (t <= base_) {
+        heapAdd(due_, Due, entry);
+        return;
+    }
+    if (diff >> (SlotBits * Levels)) {
+        heapAdd(overflow_, Overflow, entry);
+        return;
+    }
+
+    level = (63 - __builtin_clzll(diff)) / SlotBits;
+    slot  = (t >> (level * SlotBits)) & (Slots - 1);
+    occupied_[level][slot / 64] |= 1ULL << (slot % 64);
+    slot += level * Slots;
+
+    if (entry.activity) {
+        entry.activity->waitingSlot_  = slot;
+        entry.activity->waitingIndex_ = slot_[slot].size();
+    }
+    slot_[slot].push_back(entry);
+}
+
+void
+WheelManagerImpl::waitingQueueAdd (const WaitingEntry &entry)
+{
+    if (entry.activity) {
+        entry.activity->newRef();
+    }
+    slotAdd(entry);
+    size_++;
+    dueFill();
+}
+
+void
+WheelManagerImpl::waitingQueueDel (ActivityImpl *activity)
+{
+    unsigned int slot = activity->waitingSlot_;
+
+    if (slot == ActivityImpl::NotWaiting) {
+        return;
+    }
+
+    if (slot == Due) {
+        heapRemove(due_, activity->waitingIndex_);
+    } else if (slot == Overflow) {
+        heapRemove(overflow_, activity->waitingIndex_);
+    } else {
+        /*
+         * slots are unordered, fill the hole with the last entry
+         */
+        vector<WaitingEntry> &bucket = slot_[slot];
+        unsigned int i = activity->waitingIndex_;
+
+        bucket[i] = bucket.back();
+        if (bucket[i].activity) {
+            bucket[i].activity->waitingIndex_ = i;
+        }
+        bucket.pop_back();
+        if (bucket.empty()) {
+            occupied_[slot / Slots][(slot % Slots) / 64] &= ~(1ULL << (slot % 64));
+        }
+    }
+
+    activity->waitingSlot_  = ActivityImpl::NotWaiting;
+    activity->waitingIndex_ = ActivityImpl::NotWaiting;
+    activity->deleteRef();
+    size_--;
+    dueFill();
+}
+
+/**
+ * heapCompact:
+ *
+ * drop the stale entries of the due or overflow heap and restore
+ * its order
+ */
+
+void
+WheelManagerImpl::heapCompact (vector<WaitingEntry> &heap, unsigned int slot)
+{
+    unsigned int kept = 0;
+
+    for (unsigned int i = 0; i < heap.size(); i++) {
+        if (stale(heap[i])) {
+            if (heap[i].activity) {
+                heap[i].activity->deleteRef();
+            }
+            continue;
+        }
+        heap[kept] = heap[i];
+        if (heap[kept].activity) {
+            heap[kept].activity->waitingSlot_ = slot;
+        }
+        kept++;
+    }
+    heap.resize(kept);
+    heapMake(heap);
+    size_ += kept;
+}
+
+/**
+ * waitingQueueCompact:
+ *
+ * filter every slot and both heaps, slots keep no order so only
+ * the heaps have to be rebuilt
+ */
+
+void
+WheelManagerImpl::waitingQueueCompact ()
+{
+    size_ = 0;
+    for (unsigned int s = 0; s < Overflow; s++) {
+        vector<WaitingEntry> &bucket = slot_[s];
+        unsigned int kept = 0;
+
+        for (unsigned int i = 0; i < bucket.size(); i++) {
+            if (stale(bucket[i])) {
+                if (bucket[i].activity) {
+                    bucket[i].activity->deleteRef();
+                }
+                continue;
+            }
+            bucket[kept] = bucket[i];
+            if (bucket[kept].activity) {
+                bucket[kept].activity->waitingSlot_  = s;
+                bucket[kept].activity->waitingIndex_ = kept;
+            }
+            kept++;
+        }
+        bucket.resize(kept);
+        size_ += kept;
+        if (!kept) {
+            occupied_[s / Slots][(s % Slots) / 64] &= ~(1ULL << (s % 64));
+        }
+    }
+    heapCompact(overflow_, Overflow);
+    heapCompact(due_, Due);
+    dueFill();
+}
+
+/**
+ * slotCascade:
+ *
+ * base_ has just moved to the start of slot, redistribute its
+ * entries to the lower levels (or the due heap)
+ */
+
+void
+WheelManagerImpl::slotCascade (unsigned int slot)
+{
+    vector<WaitingEntry> bucket;
+
+    bucket.swap(slot_[slot]);
+    occupied_[slot / Slots][(slot % Slots) / 64] &= ~(1ULL << (slot % 64));
+    for (unsigned int i = 0; i < bucket.size(); i++) {
+        slotAdd(bucket[i]);
+    }
+}
+
+/**
+ * advance:
+ *
+ * move base_ to the earliest occupied slot and cascade it.
+ * return false if nothing is waiting
+ */
+
+bool
+WheelManagerImpl::advance ()
+{
+    for (unsigned int level = 0; level < Levels; level++) {
+        unsigned int shift = level * SlotBits;
+        unsigned int digit = (base_ >> shift) & (Slots - 1);
+
+        for (unsigned int s = digit + 1; s < Slots; ) {
+            unsigned long long word = occupied_[level][s / 64] >> (s % 64);
+
+            if (!word) {
+                s = (s / 64 + 1) * 64;
+                continue;
+            }
+            s += __builtin_ctzll(word);
+
+            /*
+             * clear the digits below and including this level,
+             * then step to the slot found
+             */
+            base_ = (base_ >> (shift + SlotBits)) << (shift + SlotBits);
+            base_ |= (unsigned long long)s << shift;
+            slotCascade(level * Slots + s);
+            return true;
+        }
+    }
+
+    /*
+     * the whole wheel is empty, jump to the earliest overflow entry
+     * and bring in only the entries the new horizon covers
+     */
+    if (overflow_.empty()) {
+        return false;
+    }
+    base_ = tick(overflow_[0].time);
+    while (!overflow_.empty() && 
+           !((tick(overflow_[0].time) ^ base_) >> (SlotBits * Levels))) {
+        slotAdd(heapRemove(overflow_, 0));
+    }
+    return true;
+}
+
+/**
+ * dueFill:
+ *
+ * turn the wheel until something is due or nothing is left.  Every
+ * change to the waiting queue ends here, so the head can be read
+ * without turning it.
+ */
+
+void
+WheelManagerImpl::dueFill ()
+{
+    while (due_.empty() && advance()) {
+    }
+}
+
+bool
+WheelManagerImpl::waitingQueueHead (WaitingEntry &entry)
+{
+    if (due_.empty()) {
+        return false;
+    }
+    entry = due_[0];
+    return true;
+}
+
+/**
+ * waitingQueuePop:
+ *
+ * drop the entry returned by the last waitingQueueHead
+ */
+
+void
+WheelManagerImpl::waitingQueuePop ()
+{
+    ActivityImpl *activity = heapRemove(due_, 0).activity;
+
+    size_--;
+    if (activity) {
+        activity->waitingSlot_  = ActivityImpl::NotWaiting;
+        activity->waitingIndex_ = ActivityImpl::NotWaiting;
+        activity->deleteRef();
+    }
+    dueFill();
+}
+
+Time
+WheelManagerImpl::nextTimeout () const
+{
+    if (due_.empty()) {
+        return Activity::Never;
+    }
+    return due_[0].time;
+}
+
+Channel::Channel()
+{
+    head_ = tail_ = new Node;
+    head_->next = NULL;
+}
+
+Channel::~Channel()
+{
+    while (head_) {
+        Node *next = head_->next;
+        delete head_;
+        head_ = next;
+    }
+}
+
+/**
+ * messageAdd:
+ *
+ * producer side, link a new node behind tail_
+ */
+
+void
+Channel::messageAdd(const Message &message)
+{
+    Node *node = new Node;
+
+    node->message = message;
+    node->next = NULL;
+    __atomic_store_n(&tail_->next, node, __ATOMIC_RELEASE);
+    tail_ = node;
+}
+
+/**
+ * messagePop:
+ *
+ * consumer side, the node after head_ becomes the new stub
+ */
+
+bool
+Channel::messagePop(Message &message)
+{
+    Node *next = __atomic_load_n(&head_->next, __ATOMIC_ACQUIRE);
+
+    if (!next) {
+        return false;
+    }
+    message = next->message;
+    next->message.callback.clear();
+    delete head_;
+    head_ = next;
+    return true;
+}
+
+ParallelManagerImpl::ParallelManagerImpl() 
+    :lookahead_(Activity::Never), exit_(false), aborted_(false)
+{
+    pthread_mutex_init(&startLock_, NULL);
+    busy_[0].push_back(0);
+    busy_[1].push_back(0);
+    parallel_ = this;
+    partition_.push_back(this);
+    channel_.push_back(new Channel);
+    nextTimeout_.push_back(Activity::Never);
+}
+
+ParallelManagerImpl::~ParallelManagerImpl()
+{
+    ACTIVITY_TRACE("Destroyed\n");
+    workersDel();
+    for (unsigned int i = 0; i < channel_.size(); i++) {
+        delete channel_[i];
+    }
+    pthread_mutex_destroy(&startLock_);
+}
+
+Ptr<Activity::Manager>
+ParallelManagerImpl::partition(unsigned int index) const
+{
+    if (index >= partition_.size()) {
+        return NULL;
+    }
+    return partition_[index];
+}
+
+/**
+ * partitionsIs:
+ *
+ * create the partitions and their threads.  Partitions can only be
+ * created once, activities already living in them would be lost.
+ */
+
+void
+ParallelManagerImpl::partitionsIs(unsigned int n)
+{
+    if (n == partition_.size()) {
+        return;
+    }
+    if (n == 0) {
+        throw RangeException();
+    }
+    if (partition_.size() != 1) {
+        throw PermissionException("partitions already created");
+    }
+
+    for (unsigned int i = 1; i < n; i++) {
+        ManagerImpl::Ptr m = new ManagerImpl();
+        if (!m) throw ResourceException();
+
+        m->parallel_ = this;
+        m->partitionIndex_ = i;
+        m->Activity::Manager::runningIs(running());
+        m->ManagerImpl::nowIs(now());
+        m->ManagerImpl::lazyCancelIs(lazyCancel());
+        owned_.push_back(m);
+        partition_.push_back(m.value());
+    }
+    busy_[0].assign(n, 0);
+    busy_[1].assign(n, 0);
+    optimismIs(optimism_);
+
+    for (unsigned int i = 0; i < channel_.size(); i++) {
+        delete channel_[i];
+    }
+    channel_.clear();
+    for (unsigned int i = 0; i < n * n; i++) {
+        channel_.push_back(new Channel);
+    }
+    nextTimeout_.assign(n, Activity::Never);
+
+    /*
+     * the workers wait for the start lock before they go near the
+     * barrier, which is only made once all of them are running
+     */
+    worker_.resize(n);
+    pthread_mutex_lock(&startLock_);
+    for (unsigned int i = 1; i < n; i++) {
+        worker_[i].manager = this;
+        worker_[i].index = i;
+        if (pthread_create(&worker_[i].thread, NULL, workerMain, &worker_[i])) {
+            startAbort(i);
+            throw ResourceException("cannot create partition thread");
+        }
+    }
+    if (pthread_barrier_init(&barrier_, NULL, n)) {
+        startAbort(n);
+        throw ResourceException("cannot create partition barrier");
+    }
+    pthread_mutex_unlock(&startLock_);
+}
+
+/**
+ * startAbort:
+ *
+ * the workers could not all be started.  The ones that were, below
+ * started, are let go before they reach the barrier and joined; the
+ * manager is left with its single partition.  Called with the start
+ * lock held.
+ */
+
+void
+ParallelManagerImpl::startAbort(unsigned int started)
+{
+    aborted_ = true;
+    pthread_mutex_unlock(&startLock_);
+    for (unsigned int i = 1; i < started; i++) {
+        pthread_join(worker_[i].thread, NULL);
+    }
+    aborted_ = false;
+    worker_.clear();
+
+    for (unsigned int i = 0; i < channel_.size(); i++) {
+        delete channel_[i];
+    }
+    channel_.assign(1, new Channel);
+    partition_.resize(1);
+    owned_.clear();
+    busy_[0].assign(1, 0);
+    busy_[1].assign(1, 0);
+    nextTimeout_.assign(1, Activity::Never);
+}
+
+void
+ParallelManagerImpl::workersDel()
+{
+    if (worker_.size() < 2) {
+        return;
+    }
+    exit_ = true;
+    pthread_barrier_wait(&barrier_);
+    for (unsigned int i = 1; i < worker_.size(); i++) {
+        pthread_join(worker_[i].thread, NULL);
+    }
+    pthread_barrier_destroy(&barrier_);
+    worker_.clear();
+}
+
+/**
+ * lookaheadIs:
+ *
+ * the smallest delay of any timer posted across partitions, it is
+ * the longest window partitions can run without hearing from
+ * each other.  Links are checked against it as they are made, so
+ * once activities run on more than one partition it may only
+ * shrink.
+ */
+
+void
+ParallelManagerImpl::lookaheadIs(Time t)
+{
+    if (t <= Time()) {
+        throw RangeException();
+    }
+    if (t > lookahead_) {
+        for (unsigned int i = 1; i < partition_.size(); i++) {
+            if (partition_[i]->activities()) {
+                throw PermissionException("lookahead cannot grow once partitions are in use");
+            }
+        }
+    }
+    lookahead_ = t;
+    optimismIs(optimism_);
+}
+
+/**
+ * optimismIs:
+ *
+ * how far partitions may run ahead of each other, anything longer
+ * than the lookahead makes them speculative.  A speculative
+ * partition journals its changes and needs lazy cancel, an undone
+ * step leaves tombstones behind.
+ */
+
+void
+ParallelManagerImpl::optimismIs(Time t)
+{
+    if (t < Time()) {
+        throw RangeException();
+    }
+    optimism_ = t;
+
+    bool speculative = optimism_ > lookahead_ && partition_.size() > 1;
+    for (unsigned int i = 0; i < partition_.size(); i++) {
+        if (speculative) {
+            partition_[i]->ManagerImpl::lazyCancelIs(true);
+        }
+        partition_[i]->speculative_ = speculative;
+    }
+}
+
+void
+ParallelManagerImpl::lazyCancelIs(bool lazy)
+{
+    for (unsigned int i = 0; i < partition_.size(); i++) {
+        if (!lazy && partition_[i]->speculative_) {
+            throw PermissionException("speculative partitions cancel lazily");
+        }
+        partition_[i]->ManagerImpl::lazyCancelIs(lazy);
+    }
+}
+
+unsigned long long
+ParallelManagerImpl::rollbacks() const
+{
+    unsigned long long rollbacks = 0;
+
+    for (unsigned int i = 0; i < partition_.size(); i++) {
+        rollbacks += partition_[i]->rollbacks_;
+    }
+    return rollbacks;
+}
+
+/**
+ * profile:
+ *
+ * the partitions' profiles merged by key
+ */
+
+vector<Activity::Profile>
+ParallelManagerImpl::profile() const
+{
+    map<string, Activity::Profile>  merged;
+    vector<Activity::Profile>       profile;
+
+    for (unsigned int i = 0; i < partition_.size(); i++) {
+        vector<Activity::Profile> part = partition_[i]->ManagerImpl::profile();
+
+        for (unsigned int p = 0; p < part.size(); p++) {
+            Activity::Profile &m = merged[part[p].key];
+
+            m.key = part[p].key;
+            m.invocations += part[p].invocations;
+            m.notifiees += part[p].notifiees;
+            m.total += part[p].total;
+            if (part[p].max > m.max) {
+                m.max = part[p].max;
+            }
+        }
+    }
+    for (map<string, Activity::Profile>::iterator i = merged.begin(); i != merged.end(); i++) {
+        profile.push_back(i->second);
+    }
+    sort(profile.begin(), profile.end(), costlier);
+    return profile;
+}
+
+/*
+ * events of different partitions interleave differently from run
+ * to run, only a single partition has a well defined trace
+ */
+void
+ParallelManagerImpl::traceIs(const string &file)
+{
+    if (!file.empty() && partition_.size() > 1) {
+        throw PermissionException("only a single partition run can be traced");
+    }
+    ManagerImpl::traceIs(file);
+}
+
+void
+ParallelManagerImpl::replayIs(const string &file, Time from, Time to)
+{
+    if (!file.empty() && partition_.size() > 1) {
+        throw PermissionException("only a single partition run can be replayed");
+    }
+    ManagerImpl::replayIs(file, from, to);
+}
+
+void
+ParallelManagerImpl::snapshotIs(Ptr<Activity::Checkpoint> checkpoint)
+{
+    if (partition_.size() > 1) {
+        throw PermissionException("only a single partition run can be checkpointed");
+    }
+    ManagerImpl::snapshotIs(checkpoint);
+}
+
+void
+ParallelManagerImpl::restoreIs(Ptr<Activity::Checkpoint> checkpoint)
+{
+    if (partition_.size() > 1) {
+        throw PermissionException("only a single partition run can be checkpointed");
+    }
+    ManagerImpl::restoreIs(checkpoint);
+}
+
+unsigned long long
+ParallelManagerImpl::batchHistogram(unsigned int bucket) const
+{
+    unsigned long long batches = 0;
+
+    for (unsigned int i = 0; i < partition_.size(); i++) {
+        batches += partition_[i]->ManagerImpl::batchHistogram(bucket);
+    }
+    return batches;
+}
+
+double
+ParallelManagerImpl::efficiency() const
+{
+    unsigned long long events = 0, undone = 0;
+
+    for (unsigned int i = 0; i < partition_.size(); i++) {
+        events += partition_[i]->events_;
+        undone += partition_[i]->eventsUndone_;
+    }
+    if (events == 0) {
+        return 1.0;
+    }
+    return (double)(events - undone) / events;
+}
+
+/**
+ * nextEvent:
+ *
+ * earliest pending event over all partitions, only meaningful
+ * between runs while the workers are parked
+ */
+
+Time
+ParallelManagerImpl::nextEvent() const
+{
+    Time next = nextTimeout();
 
-void 
-RealTimeManagerImpl::nowIs(Time t)
+    for (unsigned int i = 1; i < partition_.size(); i++) {
+        if (partition_[i]->nextTimeout() < next) {
+            next = partition_[i]->nextTimeout();
+        }
+    }
+    return next;
+}
+
+void
+ParallelManagerImpl::runningIs(bool r)
 {
-    Time virtualTime;
+    for (unsigned int i = 0; i < partition_.size(); i++) {
+        partition_[i]->Activity::Manager::runningIs(r);
+    }
+}
 
-    if (t == now()) return;
+/**
+ * nowIs:
+ *
+ * when not running, move every partition's clock.  Otherwise
+ * start the workers on a run up to t and take partition 0's
+ * share in this thread.
+ */
 
-    virtualTime = Time(t.value() / ratio().value());
+void
+ParallelManagerImpl::nowIs(Time t)
+{
+    if (t == now()) return;
 
-    if (!running()) {
-        startTime_ = t;
-        if (virtualManager_) {
-            startVirtualTime_ = virtualManager_->now();
+    if (!running() || partition_.size() == 1) {
+        for (unsigned int i = 0; i < partition_.size(); i++) {
+            partition_[i]->ManagerImpl::nowIs(t);
         }
-        ManagerImpl::nowIs(t);
         return;
     }
 
-    Time current;
-    struct timeval tv;
+    target_ = t;
+    pthread_barrier_wait(&barrier_);
+    run(0);
+}
+
+void *
+ParallelManagerImpl::workerMain(void *arg)
+{
+    Worker *worker = static_cast<Worker *>(arg);
+    bool abort;
+
+    pthread_mutex_lock(&worker->manager->startLock_);
+    abort = worker->manager->aborted_;
+    pthread_mutex_unlock(&worker->manager->startLock_);
+    if (abort) {
+        return NULL;
+    }
+
     do {
-        gettimeofday(&tv, NULL);
-        current = Time(tv);
-        if (current > t) {
+        pthread_barrier_wait(&worker->manager->barrier_);
+        if (worker->manager->exit_) {
             break;
         }
-        ManagerImpl::nowIs(current);
-        if (virtualManager_) {
-            virtualTime = startVirtualTime_ + 
-                          Time((current - startTime_).value() / ratio().value());
-            virtualManager_->nowIs(virtualTime);
+        worker->manager->run(worker->index);
+    } while (1);
+
+    return NULL;
+}
+
+/**
+ * drain:
+ *
+ * turn everything posted to partition index into keyed timers.  A
+ * speculative partition rolls back for a timer due at or before its
+ * clock, and for an anti message whose timer has already fired.
+ */
+
+void
+ParallelManagerImpl::drain(unsigned int index)
+{
+    ManagerImpl         *m = partition_[index];
+    Channel::Message    message;
+
+    for (unsigned int from = 0; from < partition_.size(); from++) {
+        Channel *c = channel(from, index);
+        while (c->messagePop(message)) {
+            if (!m->speculative_) {
+                m->timerNew(message.time, message.key, message.callback);
+                continue;
+            }
+
+            if (message.anti) {
+                ManagerImpl::InboundIndex::iterator in = m->inbound_.find(message.id);
+                if (in == m->inbound_.end()) {
+                    ACTIVITY_ERR("anti message for unknown timer\n");
+                    continue;
+                }
+                if (!m->timerPending((*in).second.timer)) {
+                    m->rollbackIs((*in).second.time);
+                }
+                m->timerDel((*in).second.timer);
+                m->inbound_.erase(in);
+                continue;
+            }
+
+            if (message.time <= m->now_) {
+                m->rollbackIs(message.time);
+            }
+            ManagerImpl::Inbound &in = m->inbound_[message.id];
+            in.timer    = m->timerNew(message.time, message.key, message.callback);
+            in.time     = message.time;
+            in.sent     = message.sent;
         }
-        reschedule();
-        runReadyQueue();
-    } while(1);
+    }
+}
+
+/**
+ * run:
+ *
+ * window loop of one partition, every partition goes through the
+ * same barriers.  A window starts at the earliest pending time of
+ * all partitions and lasts one lookahead, anything posted in it is
+ * due in a later window and is drained after the closing barrier.
+ *
+ * A speculative window lasts the optimism instead and is settled in
+ * rounds: posted timers and anti messages are drained, rolled back
+ * partitions run up to the window end again, and the rounds go on
+ * as long as any partition posted something.
+ */
+
+void
+ParallelManagerImpl::run(unsigned int index)
+{
+    ManagerImpl *m = partition_[index];
+
+    do {
+        drain(index);
+        nextTimeout_[index] = m->nextTimeout();
+        pthread_barrier_wait(&barrier_);
+
+        Time start = nextTimeout_[0];
+        for (unsigned int i = 1; i < nextTimeout_.size(); i++) {
+            if (nextTimeout_[i] < start) {
+                start = nextTimeout_[i];
+            }
+        }
+
+        Time window = m->speculative_ ? optimism_ : lookahead_;
+        Time end = target_;
+        if (start < target_ && start + window < target_) {
+            end = start + window;
+        }
+
+        if (!m->speculative_) {
+            m->windowEnd_ = end;
+            m->ManagerImpl::nowIs(end);
+            pthread_barrier_wait(&barrier_);
+            if (end == target_) {
+                break;
+            }
+            continue;
+        }
+
+        /*
+         * the window start is the GVT, nothing posted from now on
+         * can be due before it
+         */
+        unsigned long long posted = m->messages_;
+
+        m->fossilCollect(start);
+        m->windowEnd_ = start;
+        m->windowNow_ = m->now_;
+        m->ManagerImpl::nowIs(end);
+        for (unsigned int round = 0; ; round++) {
+            vector<int> &busy = busy_[round & 1];
+
+            busy[index] = m->messages_ != posted;
+            posted = m->messages_;
+            pthread_barrier_wait(&barrier_);
+            if (find(busy.begin(), busy.end(), 1) == busy.end()) {
+                break;
+            }
+            drain(index);
+            if (m->now_ < end) {
+                m->ManagerImpl::nowIs(end);
+            }
+        }
+        pthread_barrier_wait(&barrier_);
+
+        if (end == target_) {
+            break;
+        }
+    } while (1);
 }
 
 Ptr<Activity::Manager> vam;
+string                 vamType;
 Ptr<Activity::Manager> ram;
+Ptr<Simulation>        simulation;
 
 } // namespace ActivityImpl
 
+const char Activity::Checkpoint::Magic[8] = { 'A', 'C', 'T', 'C', 'K', 'P', 'T', 0 };
+
+/**
+ * Checkpoint:
+ *
+ * create file and write the header, or open it and check the header
+ */
+
+Activity::Checkpoint::Checkpoint(const string &file, Mode mode)
+    :file_(file), mode_(mode), stream_(NULL), size_(0)
+{
+    char magic[sizeof(Magic)];
+
+    if (!(stream_ = fopen(file.c_str(), mode == Save ? "wb" : "rb"))) {
+        throw ResourceException();
+    }
+    if (mode == Save) {
+        fwrite(Magic, sizeof(Magic), 1, stream_);
+        integerIs(Version);
+        return;
+    }
+    if (fseek(stream_, 0, SEEK_END) || (size_ = ftell(stream_)) < 0 ||
+        fseek(stream_, 0, SEEK_SET)) {
+        fclose(stream_);
+        throw ResourceException();
+    }
+    if (fread(magic, sizeof(magic), 1, stream_) != 1 || 
+        memcmp(magic, Magic, sizeof(magic)) || integer() != Version) {
+        fclose(stream_);
+        throw RangeException();
+    }
+}
+
+/*
+ * a checkpoint dropped without close is not known to be complete,
+ * a saved one is removed
+ */
+Activity::Checkpoint::~Checkpoint()
+{
+    if (stream_) {
+        fclose(stream_);
+        if (mode_ == Save) {
+            remove(file_.c_str());
+        }
+    }
+}
+
+/**
+ * close:
+ *
+ * close the file.  Writes are buffered, a short or failed one only
+ * shows in the error flag or when the buffer is flushed: if either
+ * went wrong the partial file is removed and ResourceException thrown.
+ */
+
+void
+Activity::Checkpoint::close()
+{
+    bool failed;
+
+    if (!stream_) {
+        return;
+    }
+    failed = ferror(stream_) != 0;
+    if (fclose(stream_)) {
+        failed = true;
+    }
+    stream_ = NULL;
+    if (failed && mode_ == Save) {
+        remove(file_.c_str());
+        throw ResourceException("checkpoint '" + file_ + "' could not be written");
+    }
+}
+
+FILE *
+Activity::Checkpoint::stream() const
+{
+    if (!stream_) {
+        throw PermissionException("checkpoint is closed");
+    }
+    return stream_;
+}
+
+Activity::Ptr
+Activity::Checkpoint::activity(Activity::Handle saved) const
+{
+    if (saved >= activity_.size()) {
+        return NULL;
+    }
+    return activity_[saved];
+}
+
+void
+Activity::Checkpoint::activityIs(Activity::Handle saved, Activity::Ptr activity)
+{
+    if (saved >= activity_.size()) {
+        activity_.resize(saved + 1);
+    }
+    activity_[saved] = activity;
+}
+
+unsigned long long
+Activity::Checkpoint::integer()
+{
+    unsigned long long v;
+
+    if (!ActivityImpl::varintGet(stream(), v)) {
+        throw RangeException();
+    }
+    return v;
+}
+
+void
+Activity::Checkpoint::integerIs(unsigned long long v)
+{
+    ActivityImpl::varintPut(stream(), v);
+}
+
+/*
+ * times are zigzag encoded, Never and small deltas both stay short
+ */
+Time
+Activity::Checkpoint::time()
+{
+    unsigned long long v = integer();
+
+    return Time((int64_t)(v >> 1) ^ -(int64_t)(v & 1));
+}
+
+void
+Activity::Checkpoint::timeIs(Time t)
+{
+    integerIs(((unsigned long long)t.value() << 1) ^ (unsigned long long)(t.value() >> 63));
+}
+
+/*
+ * reals are the bit pattern of the double, least significant byte
+ * first, whatever the byte order of the host
+ */
+double
+Activity::Checkpoint::real()
+{
+    FILE *file = stream();
+    uint64_t bits = 0;
+    double d;
+
+    for (unsigned int i = 0; i < sizeof(bits); i++) {
+        int c = getc(file);
+
+        if (c == EOF) {
+            throw RangeException();
+        }
+        bits |= (uint64_t)c << (8 * i);
+    }
+    memcpy(&d, &bits, sizeof(d));
+    return d;
+}
+
+void
+Activity::Checkpoint::realIs(double d)
+{
+    FILE *file = stream();
+    uint64_t bits;
+
+    memcpy(&bits, &d, sizeof(bits));
+    for (unsigned int i = 0; i < sizeof(bits); i++) {
+        putc((int)(bits >> (8 * i)) & 0xff, file);
+    }
+}
+
+/*
+ * a length running past the end of the file is refused before
+ * anything is allocated for it
+ */
+string
+Activity::Checkpoint::text()
+{
+    unsigned long long length = integer();
+    long offset = ftell(stream());
+
+    if (offset < 0 || length > (unsigned long long)(size_ - offset)) {
+        throw RangeException();
+    }
+    string s(length, '\0');
+
+    if (length && fread(&s[0], length, 1, stream()) != 1) {
+        throw RangeException();
+    }
+    return s;
+}
+
+void
+Activity::Checkpoint::textIs(const string &s)
+{
+    integerIs(s.size());
+    fwrite(s.data(), s.size(), 1, stream());
+}
+
+/**
+ * ActivityFactory:
+ *
+ * create a new virtual time Activity::Manager of the given type:
+ * "heap" (default), "timing wheel" or "parallel"
+ */
+
+Ptr<Activity::Manager> ActivityFactory(const string &type)
+{
+    Ptr<Activity::Manager> m;
+
+    if (type == "" || type == "heap") {
+        m = new ActivityImpl::ManagerImpl();
+    } else if (type == "timing wheel") {
+        m = new ActivityImpl::WheelManagerImpl();
+    } else if (type == "parallel") {
+        m = new ActivityImpl::ParallelManagerImpl();
+    } else {
+        throw RangeException();
+    }
+    if (!m) throw ResourceException();
+
+    return m;
+}
+
+Ptr<Activity::Manager> ActivityFactory()
+{
+    return ActivityFactory("");
+}
+
+/**
+ * ActivityManager:
+ *
+ * return the process wide virtual time manager, the first call
+ * decides its type.  It only backs SimulationDefault(), the network
+ * itself reaches its managers through its Simulation; a simulation
+ * on another type is made by SimulationFactory(), not by asking
+ * for the process wide one again.
+ */
+
+Ptr<Activity::Manager> ActivityManager(const string &type)
+{
+    if (!ActivityImpl::vam) {
+        ActivityImpl::vam = ActivityFactory(type);
+        ActivityImpl::vamType = type;
+        return ActivityImpl::vam;
+    }
+
+    if (type != ActivityImpl::vamType) {
+        throw PermissionException("activity manager already created as '" + 
+                                  ActivityImpl::vamType + 
+                                  "', use SimulationFactory for another type");
+    }
+    return ActivityImpl::vam;
+}
+
 Ptr<Activity::Manager> ActivityManager()
 {
     if (!ActivityImpl::vam) {
-        ActivityImpl::vam = new ActivityImpl::ManagerImpl();
-        if (!ActivityImpl::vam) {
-            throw ResourceException();
-        }
+        return ActivityManager("");
     }
 
     return ActivityImpl::vam;
@@ -492,4 +3554,122 @@ Ptr<Activity::Manager> RealTimeActivityManager()
     return ActivityImpl::ram;
 }
 
+/**
+ * realTimeActivityManager:
+ *
+ * the global virtual time manager shares RealTimeActivityManager(),
+ * any other gets a real time manager of its own
+ */
+
+Ptr<Activity::Manager>
+Simulation::realTimeActivityManager()
+{
+    if (realTimeActivityManager_) {
+        return realTimeActivityManager_;
+    }
+    if (activityManager_ == ActivityImpl::vam) {
+        realTimeActivityManager_ = RealTimeActivityManager();
+    } else {
+        realTimeActivityManager_ = 
+            new ActivityImpl::RealTimeManagerImpl(activityManager_);
+        if (!realTimeActivityManager_) throw ResourceException();
+    }
+    return realTimeActivityManager_;
+}
+
+/**
+ * interfaceOrdinalNew:
+ *
+ * the ordinal an interface is found by, across partitions too.
+ * Like a node id it is never handed out again.
+ */
+
+unsigned int
+Simulation::interfaceOrdinalNew(NetworkImpl::Interface *intf)
+{
+    unsigned int ordinal = interface_.size();
+
+    if (ordinal == UINT_MAX) {
+        throw ResourceException("out of interface ordinals");
+    }
+    interface_.push_back(intf);
+    return ordinal;
+}
+
+/**
+ * interfaceOrdinalIs:
+ *
+ * file intf under a given ordinal, restoring a checkpoint.  The
+ * ordinal must be free.
+ */
+
+void
+Simulation::interfaceOrdinalIs(unsigned int ordinal, NetworkImpl::Interface *intf)
+{
+    if (ordinal == UINT_MAX) {
+        throw RangeException();
+    }
+    if (ordinal >= interface_.size()) {
+        interface_.resize(ordinal + 1, NULL);
+    }
+    if (interface_[ordinal]) {
+        throw RangeException();
+    }
+    interface_[ordinal] = intf;
+}
+
+void
+Simulation::interfaceOrdinalDel(unsigned int ordinal)
+{
+    if (ordinal < interface_.size()) {
+        interface_[ordinal] = NULL;
+    }
+}
+
+/**
+ * nodeIdNew:
+ *
+ * the id packet descriptors name the node by.  Id 0 is no node, an
+ * id is never handed out again: descriptors still queued, on a wire
+ * or in a route table may name a deleted node, its id has to keep
+ * finding nothing.
+ */
+
+unsigned int
+Simulation::nodeIdNew(NetworkImpl::Node *node)
+{
+    unsigned int id = node_.size();
+
+    if (id == UINT_MAX) {
+        throw ResourceException("out of node ids");
+    }
+    node_.push_back(node);
+    return id;
+}
+
+void
+Simulation::nodeIdDel(unsigned int id)
+{
+    if (id < node_.size()) {
+        node_[id] = NULL;
+    }
+}
+
+Ptr<Simulation> SimulationFactory(const string &type)
+{
+    Ptr<Simulation> simulation = new Simulation(ActivityFactory(type));
+
+    if (!simulation) throw ResourceException();
+    return simulation;
+}
+
+Ptr<Simulation> SimulationDefault()
+{
+    if (!ActivityImpl::simulation) {
+        ActivityImpl::simulation = new Simulation(ActivityManager());
+        if (!ActivityImpl::simulation) throw ResourceException();
+    }
+    return ActivityImpl::simulation;
+}
+
 /* end of file */
@@ -11,11 +11,16 @@
 #define __ACTIVITY_IMPL_H__
 
 #include "Activity.h"
+#include <deque>
+#include <stdio.h>
+#include <pthread.h>
+#include <tr1/unordered_map>
 #include <sys/types.h>
 #include <sys/times.h>
 
 
 Ptr<Activity::Manager> ActivityFactory();
+Ptr<Activity::Manager> ActivityFactory(const string &type);
 
 namespace ActivityImpl {
 
@@ -23,11 +28,14 @@ extern Log logActivity;
 
 #define ACTIVITY_ERR(format, args...) \
 logActivity.entryNew(Log::Error, this->name(), __FUNCTION__, format, ##args)
+#define ACTIVITY_INFO(format, args...) \
+logActivity.entryNew(Log::Info, this->name(), __FUNCTION__, format, ##args)
 #define ACTIVITY_TRACE(format, args...) \
 logActivity.entryNew(Log::Debug, this->name(), __FUNCTION__, format, ##args)
 
 
 class ManagerImpl;
+class ParallelManagerImpl;
 class ActivityImpl : public Activity {
 public:
     // Types
@@ -37,15 +45,40 @@ public:
     void statusIs (Status s);
     void lastNotifieeIs(Ptr<RootNotifiee> p);
     void nextTimeIs(Time t);
+    void timeoutNotifieeIs(Ptr<RootNotifiee> p);
+#ifdef ACTIVITY_PROFILE
+    void labelIs(const string &label) { Activity::labelIs(label); profile_ = NULL; }
+#endif
 
     // Constructor/Destructor
-    ActivityImpl(string name, ManagerImpl *manager)
-        :Activity(name), manager_(manager) {}
+    ActivityImpl(const string &name, Handle handle, ManagerImpl *manager)
+        :Activity(name, handle), manager_(manager), 
+        waitingIndex_(NotWaiting), waitingSlot_(NotWaiting), 
+        waitingGeneration_(0), waitingLive_(false), waitingSequence_(0),
+        readyTicket_(0)
+#ifdef ACTIVITY_PROFILE
+        , profile_(NULL)
+#endif
+        {}
 
 private:
-    ManagerImpl *manager_;
+    friend class ManagerImpl;
+    friend class WheelManagerImpl;
+    static const unsigned int NotWaiting = (unsigned int)-1;
+
+    ManagerImpl     *manager_;
+    unsigned int    waitingIndex_;  // position in the manager's waiting queue
+    unsigned int    waitingSlot_;   // timing wheel slot holding the activity
+    unsigned int    waitingGeneration_; // bumped to turn its entry stale
+    bool            waitingLive_;   // has a current waiting queue entry
+    unsigned long long waitingSequence_; // of the current entry
+    unsigned int    readyTicket_;   // bumped to unlink it from the ready queue
+#ifdef ACTIVITY_PROFILE
+    Activity::Profile *profile_;    // the manager's record for our key
+#endif
 
     void execute();
+    unsigned int dispatch();
 };
 
 class ManagerImpl : public Activity::Manager {
@@ -54,34 +87,272 @@ public:
     typedef Ptr<ManagerImpl> Ptr;
 
     // Accessor
+    Activity::Ptr   activity(Activity::Handle handle) const;
     Activity::Ptr   activity(const string &name) const;
     Time            now() const { return now_; }
     string          name() const { return "Activity::ManagerImpl"; }
+    bool            lazyCancel() const { return lazyCancel_; }
+    double          staleRatio() const;
+    bool            speculative() const { return recording_; }
+    unsigned long long rollbacks() const { return rollbacks_; }
+    double          efficiency() const;
+    unsigned long long batchHistogram(unsigned int bucket) const;
+    vector<Activity::Profile> profile() const;
+    unsigned long long traceEvents() const { return traceEvents_; }
+    unsigned long long replayMismatches() const { return replayMismatches_; }
+    virtual Time    nextEvent() const { return nextTimeout(); }
+    unsigned int    activities() const { return activity_.size() - freeHandle_.size(); }
 
     // Mutator
+    Activity::Ptr   activityNew();
     Activity::Ptr   activityNew(const string &name);
+    void            activityDel(Activity::Handle handle);
     void            activityDel(const string &name);
+    Activity::Timer timerNew(Time t, const Activity::Callback &callback);
+    Activity::Timer timerNew(Time t, unsigned long long key, 
+                             const Activity::Callback &callback);
+    void            timerPost(Activity::Manager *to, Time t, unsigned long long key,
+                              const Activity::Callback &callback);
+    void            timerDel(Activity::Timer timer);
+    void            lazyCancelIs(bool lazy);
+    void            undoIs(const Activity::Callback &undo);
+    void            traceIs(const string &file);
+    void            replayIs(const string &file, Time from = Time(Time::MIN), 
+                             Time to = Activity::Never);
+    void            snapshotIs(Ptr<Activity::Checkpoint> checkpoint);
+    void            restoreIs(Ptr<Activity::Checkpoint> checkpoint);
     void            nowIs(Time t);
     void            waitingQueueIs(Ptr<Activity> act);
     void            readyQueueIs(Ptr<Activity> act);
 
     // Constructor/Destructor
-    ManagerImpl() {}
-    ~ManagerImpl() { ACTIVITY_TRACE("Destroyed\n"); }
+    ManagerImpl() 
+        :freeCommitted_(0), readyHead_(0), sequence_(0), lazyCancel_(false), stale_(0), 
+        parallel_(NULL), partitionIndex_(0), windowEnd_(Activity::Never),
+        speculative_(false), recording_(false), messages_(0), events_(0),
+        eventsUndone_(0), rollbacks_(0), trace_(NULL), replay_(false),
+        traceEvents_(0), replayMismatches_(0) {
+        for (unsigned int i = 0; i < BatchBuckets; i++) {
+            batchHistogram_[i] = 0;
+        }
+    }
+    ~ManagerImpl();
 
 protected:
-    Time nextTimeout() const;
+    /*
+     * waiting queue entry, the key is kept inline so the queue
+     * can be ordered without touching the activity
+     */
+    struct WaitingEntry {
+        Time                time;
+        unsigned long long  sequence;   // insertion order, breaks ties
+        ActivityImpl        *activity;  // NULL for a timer
+        unsigned int        timer;      // timer slot
+        unsigned int        generation; // of the activity or timer
+    };
+
+    virtual Time nextTimeout() const;
     void reschedule();
     void runReadyQueue();
+    bool stale(const WaitingEntry &entry) const;
+
+    /*
+     * waiting queue primitives, ordered on (time, sequence).
+     * add takes a reference on the activity, del and pop release it
+     */
+    virtual void waitingQueueAdd(const WaitingEntry &entry);
+    virtual void waitingQueueDel(ActivityImpl *activity);
+    virtual bool waitingQueueHead(WaitingEntry &entry);
+    virtual void waitingQueuePop();
+
+    /*
+     * drop every stale entry, releasing its reference, and bring
+     * the activity positions up to date
+     */
+    virtual void waitingQueueCompact();
+    virtual unsigned int waitingQueueSize() const;
+
+    /*
+     * min-heap on (time, sequence) of waiting entries, each activity
+     * keeps its position in waitingIndex_.  heapRemove leaves the
+     * activity's reference and position to the caller
+     */
+    static void heapPlace(vector<WaitingEntry> &heap, unsigned int i, 
+                          const WaitingEntry &entry);
+    static void heapUp(vector<WaitingEntry> &heap, unsigned int i);
+    static void heapDown(vector<WaitingEntry> &heap, unsigned int i);
+    static void heapMake(vector<WaitingEntry> &heap);
+    static WaitingEntry heapRemove(vector<WaitingEntry> &heap, unsigned int i);
 
 private:
     friend class ActivityImpl;
+    friend class ParallelManagerImpl;
+
+    /*
+     * ready queue entry, stale once the activity's ticket moves on
+     */
+    struct ReadyEntry {
+        ActivityImpl    *activity;  // NULL for a timer
+        unsigned int    ticket;
+        Activity::Timer timer;
+    };
+
+    /*
+     * pending callback, the generation moves on when it fires or is
+     * cancelled so stale queue entries are recognized and skipped
+     */
+    struct TimerRecord {
+        Activity::Callback  callback;
+        unsigned int        generation;
+        unsigned int        issued;     // highest generation handed out
+        bool                waiting;    // its entry is in the waiting queue
+        Time                time;
+        unsigned long long  sequence;
+    };
+
+    /*
+     * journal of a speculative partition, replayed backward by
+     * rollbackIs.  Every record puts back the state from before the
+     * change it was made for.
+     */
+    struct UndoRecord {
+        enum Kind { 
+            Model,          // registered with undoIs
+            ActivityState,  // activity about to change
+            TimerAdd,       // timer created
+            TimerPop,       // timer moved to the ready queue
+            TimerRetire     // timer fired or cancelled
+        };
+        Kind                kind;
+        Activity::Callback  callback;
+        ActivityImpl::Ptr   activity;
+        Ptr<RootNotifiee>   notifiee;
+        Activity::Status    status;
+        bool                waiting;
+        Time                time;
+        unsigned long long  sequence;
+        unsigned int        timer;
+        unsigned int        generation;
+    };
+
+    /*
+     * journal position at the start of each step of a speculative
+     * run, a rollback undoes whole steps
+     */
+    struct Step {
+        Time                time;
+        unsigned int        journal;
+        unsigned int        sent;
+        unsigned long long  events;
+    };
+
+    /*
+     * timer posted to another partition, cancelled with an anti
+     * message when the step posting it is rolled back
+     */
+    struct Sent {
+        Time                time;       // when it was posted
+        unsigned int        to;
+        unsigned long long  id;
+    };
+
+    /*
+     * timer posted by another partition
+     */
+    struct Inbound {
+        Activity::Timer     timer;
+        Time                time;
+        Time                sent;
+    };
+    static const unsigned int WaitingQueueArity = 4;
+
+    /*
+     * compact once stale entries make up CompactPercent of the
+     * waiting queue, but not for fewer than CompactMin of them
+     */
+    static const unsigned int CompactPercent = 50;
+    static const unsigned int CompactMin = 64;
+
+    /*
+     * sequence numbers of unkeyed entries start here, so keyed
+     * timers always come first at the same time
+     */
+    static const unsigned long long LocalSequence = 1ULL << 63;
+
+    typedef tr1::unordered_map<string, Activity::Handle> NameIndex;
+    typedef tr1::unordered_map<unsigned long long, Inbound> InboundIndex;
 
     Time                        now_;
-    map<string, Activity::Ptr>  activity_;
-    vector<Activity::Ptr>       waitingQueue_;
-    vector<Activity::Ptr>       readyQueue_;
+    vector<ActivityImpl::Ptr>   activity_;      // indexed by handle
+    vector<Activity::Handle>    freeHandle_;    // unused slots of activity_
+    NameIndex                   nameIndex_;     // named activities only
+    deque<TimerRecord>          timer_;         // indexed by Timer::index()
+    vector<unsigned int>        freeTimer_;     // unused slots of timer_
+    unsigned int                freeCommitted_; // freeTimer_ head freed before the GVT
+    vector<WaitingEntry>        waitingQueue_;  // min-heap on (time, sequence)
+    vector<ReadyEntry>          readyQueue_;    // FIFO, the batch at now_
+    unsigned int                readyHead_;     // next entry of readyQueue_ to run
+    unsigned long long          sequence_;
+    bool                        lazyCancel_;
+    unsigned int                stale_;         // stale waiting queue entries
+    ParallelManagerImpl         *parallel_;     // owner when a partition
+    unsigned int                partitionIndex_;
+    Time                        windowEnd_;     // end of the running window
+    bool                        speculative_;   // partition runs optimistically
+    bool                        recording_;     // events are being journaled
+    vector<UndoRecord>          journal_;
+    vector<Step>                step_;
+    vector<Sent>                sent_;
+    InboundIndex                inbound_;       // by message id
+    Time                        windowNow_;     // now_ when the window started
+    unsigned long long          messages_;      // posted to other partitions
+    unsigned long long          events_;        // run, including rolled back ones
+    unsigned long long          eventsUndone_;
+    unsigned long long          rollbacks_;
+    unsigned long long          batchHistogram_[BatchBuckets];
+#ifdef ACTIVITY_PROFILE
+    typedef tr1::unordered_map<string, Activity::Profile> ProfileIndex;
+
+    ProfileIndex                profile_;       // by profile key
 
+    Activity::Profile *profileRecord(const string &key);
+#endif
+
+    /*
+     * event trace: a header, then per event the time delta and the
+     * zigzag id delta shifted left by 2 with the kind below, both
+     * as base 128 varints
+     */
+    static const char TraceMagic[8];
+    enum TraceKind { TraceTimeout, TraceNotification, TraceTimer };
+
+    FILE                        *trace_;        // recording or replaying
+    bool                        replay_;
+    Time                        traceTime_;     // of the previous record
+    unsigned int                traceId_;
+    Time                        replayFrom_;
+    Time                        replayTo_;
+    unsigned long long          traceEvents_;
+    unsigned long long          replayMismatches_;
+
+    void traceRecordIs(unsigned int id, TraceKind kind);
+    bool traceRecord(Time &time, unsigned int &id, TraceKind &kind);
+    void traceClose();
+
+    Activity::Handle handleNew();
+    void batchIs(unsigned int events);
+    void staleIs(unsigned int stale);
+    Activity::Timer timerAdd(Time t, unsigned long long sequence, 
+                             const Activity::Callback &callback);
+    bool timerPending(Activity::Timer timer) const;
+    void timerRetire(Activity::Timer timer);
+    void runTimer(Activity::Timer timer);
+    void activityJournal(ActivityImpl *activity);
+    void timerJournal(UndoRecord::Kind kind, unsigned int index);
+    void stepIs();
+    void undo(UndoRecord &record);
+    bool rollbackIs(Time t);
+    void fossilCollect(Time gvt);
     void runActivity(Activity::Ptr activity);
     void runActivityFromThread(Activity::Ptr activity);
     void reschedule(Ptr<Activity> act);
@@ -89,17 +360,232 @@ private:
     void insertToReadyQueue(Ptr<Activity> activity);
     void removeFromWaitingQueue(Activity::Ptr activity);
     void removeFromReadyQueue(Activity::Ptr activity);
+    void waitingQueueRemove(unsigned int i);
+};
+
+/**
+ * WheelManagerImpl:
+ *
+ * ManagerImpl with the waiting queue kept in a hierarchical timing
+ * wheel of nanosecond ticks.  Activities due within the wheel horizon
+ * are inserted and expired in O(1), farther ones wait in an overflow
+ * heap until the wheel catches up with them.
+ */
+class WheelManagerImpl : public ManagerImpl {
+public:
+    // Types
+    typedef Ptr<WheelManagerImpl> Ptr;
+
+    // Accessor
+    string  name() const { return "Activity::WheelManagerImpl"; }
+
+    // Constructor/Destructor
+    WheelManagerImpl();
+    ~WheelManagerImpl();
+
+protected:
+    Time nextTimeout() const;
+    void waitingQueueAdd(const WaitingEntry &entry);
+    void waitingQueueDel(ActivityImpl *activity);
+    bool waitingQueueHead(WaitingEntry &entry);
+    void waitingQueuePop();
+    void waitingQueueCompact();
+    unsigned int waitingQueueSize() const { return size_; }
+
+private:
+    static const unsigned int SlotBits  = 8;
+    static const unsigned int Slots     = 1 << SlotBits;
+    static const unsigned int Levels    = 4;
+    static const unsigned int Overflow  = Levels * Slots;  // beyond the horizon
+    static const unsigned int Due       = Overflow + 1;    // at or before base_
+    static const unsigned int MaskWords = Slots / 64;
+
+    vector<WaitingEntry>    slot_[Levels * Slots];
+    unsigned long long      occupied_[Levels][MaskWords];
+    vector<WaitingEntry>    overflow_;  // min-heap, beyond the horizon
+    vector<WaitingEntry>    due_;       // min-heap, at or before base_
+    unsigned long long      base_;  // tick the wheel has advanced to
+    unsigned int            size_;  // entries in the wheel
+
+    static unsigned long long tick(Time t);
+    void slotAdd(const WaitingEntry &entry);
+    void slotCascade(unsigned int slot);
+    void dueFill();
+    void heapAdd(vector<WaitingEntry> &heap, unsigned int slot, 
+                 const WaitingEntry &entry);
+    void heapCompact(vector<WaitingEntry> &heap, unsigned int slot);
+    bool advance();
+};
+
+/**
+ * Channel:
+ *
+ * unbounded single producer, single consumer queue carrying timers
+ * from one partition to another.  Neither side ever locks: the
+ * producer only moves tail_, the consumer only head_, and a message
+ * is handed over by the release store of its predecessor's next.
+ */
+class Channel {
+public:
+    struct Message {
+        Time                time;
+        unsigned long long  key;
+        Activity::Callback  callback;
+        unsigned long long  id;     // optimistic runs only
+        Time                sent;
+        bool                anti;   // cancels message id
+    };
+
+    // Mutator
+    void    messageAdd(const Message &message);
+    bool    messagePop(Message &message);
+
+    // Constructor/Destructor
+    Channel();
+    ~Channel();
+
+private:
+    struct Node {
+        Message message;
+        Node    *next;
+    };
+
+    Node    *head_;         // consumed stub, owned by the consumer
+    char    pad_[64];       // keep the two ends on separate cache lines
+    Node    *tail_;         // last message, owned by the producer
+
+    Channel(const Channel &);
+    Channel& operator=(const Channel &);
 };
 
+/**
+ * ParallelManagerImpl:
+ *
+ * conservative parallel simulation.  The manager itself is partition
+ * 0 and runs in the caller's thread, every other partition is a
+ * ManagerImpl with a thread of its own.  nowIs advances all of them
+ * in windows no longer than the lookahead, so a timer posted during
+ * a window always falls in a later one; posted timers are picked up
+ * from the channels at the window barrier.
+ *
+ * With an optimism longer than the lookahead the windows stretch to
+ * the optimism and partitions run speculatively (Time Warp).  At the
+ * end of a window partitions trade posted timers in rounds, rolling
+ * back past late ones and cancelling what the undone steps posted
+ * with anti messages, until no partition posts anything.  The start
+ * of the next window is then the GVT, the journals older than it are
+ * dropped.
+ */
+class ParallelManagerImpl : public ManagerImpl {
+public:
+    // Types
+    typedef Ptr<ParallelManagerImpl> Ptr;
+
+    // Accessor
+    string                  name() const { return "Activity::ParallelManagerImpl"; }
+    unsigned int            partitions() const { return partition_.size(); }
+    Ptr<Activity::Manager>  partition(unsigned int index) const;
+    Time                    lookahead() const { return lookahead_; }
+    Time                    optimism() const { return optimism_; }
+    unsigned long long      rollbacks() const;
+    double                  efficiency() const;
+    unsigned long long      batchHistogram(unsigned int bucket) const;
+    vector<Activity::Profile> profile() const;
+    Time                    nextEvent() const;
+
+    // Mutator
+    void    partitionsIs(unsigned int n);
+    void    lookaheadIs(Time t);
+    void    optimismIs(Time t);
+    void    lazyCancelIs(bool lazy);
+    void    traceIs(const string &file);
+    void    replayIs(const string &file, Time from = Time(Time::MIN), 
+                     Time to = Activity::Never);
+    void    snapshotIs(Ptr<Activity::Checkpoint> checkpoint);
+    void    restoreIs(Ptr<Activity::Checkpoint> checkpoint);
+    void    runningIs(bool r);
+    void    nowIs(Time t);
+
+    // Constructor/Destructor
+    ParallelManagerImpl();
+    ~ParallelManagerImpl();
+
+private:
+    friend class ManagerImpl;
+
+    struct Worker {
+        ParallelManagerImpl *manager;
+        unsigned int        index;
+        pthread_t           thread;
+    };
+
+    vector<ManagerImpl *>       partition_;     // [0] is this
+    vector<ManagerImpl::Ptr>    owned_;         // partitions 1 and up
+    vector<Worker>              worker_;
+    vector<Channel *>           channel_;       // [from * partitions + to]
+    vector<Time>                nextTimeout_;   // published at the barrier
+    pthread_barrier_t           barrier_;
+    pthread_mutex_t             startLock_;     // held while workers start
+    Time                        lookahead_;
+    Time                        optimism_;
+    vector<int>                 busy_[2];       // by round parity
+    Time                        target_;
+    bool                        exit_;
+    bool                        aborted_;       // the workers failed to start
+
+    Channel *channel(unsigned int from, unsigned int to) const {
+        return channel_[from * partition_.size() + to];
+    }
+    static void *workerMain(void *arg);
+    void run(unsigned int index);
+    void drain(unsigned int index);
+    void workersDel();
+    void startAbort(unsigned int started);
+};
+
+/**
+ * RealTimeManagerImpl:
+ *
+ * keeps its clock, and the clocks of its virtual managers scaled down
+ * by their ratios, in step with CLOCK_MONOTONIC.  Each virtual manager
+ * is a clock domain with a ratio of its own and a start offset, the
+ * real time after the start at which its clock begins to move.  The
+ * next events of all domains, mapped to real time, sit in one merged
+ * deadline queue; each round runs the domains that are due in
+ * deadline order, and the thread then sleeps until the earliest of
+ * the target time, its own next activity and the head of the queue,
+ * spinning only for the last spin() of it.  How late each round
+ * starts after the deadline it woke up for is the lag; lag statistics
+ * restart whenever the clock is set.
+ *
+ * An adaptive manager tunes the ratios while running: repeated lags
+ * beyond lagThreshold() double the ratio of the domain that was late,
+ * and after a few periods in a row in which a domain needed well
+ * under the real time it was given, its ratio drops toward twice the
+ * measured cost.  ratio() and ratioIs() without a domain refer to
+ * domain 0, the one virtualManagerIs sets.
+ */
 class RealTimeManagerImpl : public ManagerImpl {
 public:
     // Types
     typedef Ptr<RealTimeManagerImpl> Ptr;
+    static const int64_t SpinDefault = 50 * Time::USEC_TO_NANO;
+    static const int64_t LagThresholdDefault = 1000 * Time::USEC_TO_NANO;
+    static const int64_t AdaptPeriod = 100000 * Time::USEC_TO_NANO;
+    static const unsigned int AdaptCalmPeriods = 3;
+    static const unsigned int AdaptMisses = 2;
+    static const unsigned int AdaptHoldMax = 64;
     class Ratio : public Nominal<class Ratio__, unsigned int> {
     public:
         static const unsigned int Default = 1000;
 
         Ratio() :Nominal<class Ratio__, unsigned int>(Default) {}
+        Ratio(unsigned int r) :Nominal<class Ratio__, unsigned int>(Default) {
+            if (r == 0) {
+                throw RangeException();
+            }
+            value_ = r;
+        }
         Ratio(const Ratio &r) :Nominal<class Ratio__, unsigned int>(Default) {
             if (r.value() == 0) {
                 throw RangeException();
@@ -109,31 +595,110 @@ public:
     };
 
     // Accessor
-    Ratio ratio() const { return ratio_; }
+    Ratio ratio() const { return domain_.empty() ? Ratio() : domain_[0].ratio; }
+    Ratio ratio(unsigned int domain) const;
+    unsigned int dilation() const { return ratio().value(); }
+    bool adaptive() const { return adaptive_; }
+    Time spin() const { return spin_; }
+    Time lagMax() const { return lagMax_; }
+    Time lagThreshold() const { return lagThreshold_; }
+    unsigned long long lagMisses() const { return lagMisses_; }
+    unsigned long long lagHistogram(unsigned int bucket) const;
+    unsigned int virtualManagers() const { return domain_.size(); }
+    Ptr<Activity::Manager> virtualManager(unsigned int domain) const;
     string name() const { return "RealTimeManagerImpl"; }
 
     // Mutator
     void nowIs(Time t);
-    void ratioIs(Ratio ratio) { ratio_ = ratio; }
-    void virtualManagerIs(Ptr<Activity::Manager> am) 
-        { virtualManager_ = dynamic_cast<ManagerImpl *>(am.value()); }
+    void snapshotIs(Ptr<Activity::Checkpoint> checkpoint) {
+        throw PermissionException("real time manager cannot be checkpointed");
+    }
+    void restoreIs(Ptr<Activity::Checkpoint> checkpoint) {
+        throw PermissionException("real time manager cannot be checkpointed");
+    }
+    void ratioIs(Ratio ratio);
+    void ratioIs(unsigned int domain, Ratio ratio);
+    void adaptiveIs(bool a) { adaptive_ = a; }
+    void spinIs(Time t) { spin_ = t; }
+    void lagThresholdIs(Time t) { lagThreshold_ = t; }
+    void virtualManagerIs(Ptr<Activity::Manager> am);
+    unsigned int virtualManagerNew(Ptr<Activity::Manager> am, unsigned int ratio, Time offset);
+    void virtualManagerDel(Ptr<Activity::Manager> am);
 
     // Constructor/Destructor
-    RealTimeManagerImpl(Ptr<Activity::Manager> vm=0) { 
+    RealTimeManagerImpl(Ptr<Activity::Manager> vm=0) 
+        :spin_(SpinDefault), lagThreshold_(LagThresholdDefault), adaptive_(false) { 
         struct timeval tv;
 
-        virtualManagerIs(vm); 
+        lagReset();
         gettimeofday(&tv, NULL);
         runningIs(false);
         nowIs(Time(tv));
+        virtualManagerIs(vm); 
     }
     ~RealTimeManagerImpl() { ACTIVITY_TRACE("Destroyed\n"); }
 
 private:
-    Ptr<ManagerImpl>    virtualManager_;
-    Ratio               ratio_;
+    /*
+     * a virtual manager and the mapping of its clock onto real time:
+     * it was at anchorVirtual at real time anchor and moves one unit
+     * per ratio units of real time from there
+     */
+    struct Domain {
+        Ptr<ManagerImpl>    manager;
+        Ratio               ratio;
+        Time                offset;
+        Time                anchor;
+        Time                anchorVirtual;
+        Time                deadline;           // queued, Never if none
+        unsigned int        generation;         // of its deadline entry
+        Time                busy;               // spent in the manager this period
+        Time                periodStart;
+        Time                periodVirtualStart;
+        unsigned int        calm;               // periods in a row with room to speed up
+        unsigned int        missed;             // late rounds this period
+        unsigned int        hold;               // calm periods needed to speed up
+    };
+
+    /*
+     * merged deadline queue entry, stale once the domain's
+     * generation moves on
+     */
+    struct Deadline {
+        Time                time;
+        unsigned int        domain;
+        unsigned int        generation;
+
+        bool operator<(const Deadline &d) const {
+            return time > d.time || (time == d.time && domain > d.domain);
+        }
+    };
+
+    vector<Domain>      domain_;
+    vector<Deadline>    deadline_;          // heap, earliest on top
+    Time                spin_;
     Time                startTime_;
-    Time                startVirtualTime_;
+    Time                startClock_;        // monotonic clock at startTime_
+    Time                lagMax_;
+    Time                lagThreshold_;
+    unsigned long long  lagMisses_;
+    unsigned long long  lagHistogram_[LagBuckets];
+    bool                adaptive_;
+
+    static Time monotonic();
+    Time clock() const { return startTime_ + (monotonic() - startClock_); }
+    Time virtualTime(const Domain &domain, Time t) const;
+    Time realTime(const Domain &domain, Time virtualTime) const;
+    void waitUntil(Time t);
+    void lagIs(Time lag);
+    void lagReset();
+    void domainStart(Domain &domain, Time t);
+    void domainRun(unsigned int index, Time t);
+    void deadlineIs(unsigned int index);
+    bool deadlineHead(Deadline &head);
+    void deadlineRebuild();
+    void adapt(Domain &domain, Time current, Time lag);
+    void periodReset(Domain &domain, Time current);
 };
 
 } //end of namespace
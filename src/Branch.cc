@@ -0,0 +1,243 @@
+/*
+ * $Id: Branch.cc,v 1.1 2005/12/05 02:07:19 fzb Exp $
+ *
+ * Branch.cc -- what-if runs forked off a live simulation
+ *
+ * Fritz Budiyanto, December 2005
+ *
+ */
+
+#include <iostream>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/wait.h>
+
+#include "Branch.h"
+#include "Activity.h"
+#include "Log.h"
+
+Log logBranch("BRANCH");
+
+#define BRANCH_ERR(format, args...) \
+logBranch.entryNew(Log::Error, "Branch::Manager", __FUNCTION__, format, ##args)
+#define BRANCH_TRACE(format, args...) \
+logBranch.entryNew(Log::Debug, "Branch::Manager", __FUNCTION__, format, ##args)
+
+/*
+ * one branch per processor by default
+ */
+Branch::Manager::Manager(Ptr<Simulation> simulation)
+    :simulation_(simulation), running_(0), concurrency_(1)
+{
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (processors > 1) {
+        concurrency_ = processors;
+    }
+}
+
+Branch::Manager::~Manager()
+{
+    try {
+        runningIs(0);
+    }
+    catch (...) {}
+}
+
+Ptr<Branch>
+Branch::Manager::branch(unsigned int index) const
+{
+    if (index >= branch_.size()) {
+        return NULL;
+    }
+    return branch_[index];
+}
+
+Ptr<Branch>
+Branch::Manager::branch(const string &name) const
+{
+    for (unsigned int i = 0; i < branch_.size(); i++) {
+        if (branch_[i]->name() == name) {
+            return branch_[i];
+        }
+    }
+    return NULL;
+}
+
+void
+Branch::Manager::concurrencyIs(unsigned int n)
+{
+    if (n == 0) {
+        throw RangeException();
+    }
+    concurrency_ = n;
+}
+
+/**
+ * branchNew:
+ *
+ * fork a branch running child.  Buffered output is flushed first so
+ * the child does not print it a second time; the child leaves with
+ * _exit, it must not run the parent's destructors.
+ */
+
+Ptr<Branch>
+Branch::Manager::branchNew(const string &name, Branch::Child *child)
+{
+    int fd[2];
+
+    if (branch(name)) {
+        throw NameInUseException(name);
+    }
+    if (simulation_->activityManager()->partitions() > 1) {
+        throw PermissionException("a partitioned simulation cannot be branched");
+    }
+    runningIs(concurrency_ - 1);
+
+    Ptr<Branch> branch = new Branch(name);
+    if (!branch) throw ResourceException();
+
+    cout.flush();
+    cerr.flush();
+    fflush(NULL);
+    if (pipe(fd) < 0) {
+        throw ResourceException("cannot create a branch pipe");
+    }
+    branch->pid_ = fork();
+    if (branch->pid_ < 0) {
+        close(fd[0]);
+        close(fd[1]);
+        throw ResourceException("cannot fork a branch");
+    }
+
+    if (branch->pid_ == 0) {
+        string report;
+        int status = 0;
+
+        close(fd[0]);
+        for (unsigned int i = 0; i < branch_.size(); i++) {
+            if (branch_[i]->pipe_ >= 0) {
+                close(branch_[i]->pipe_);
+            }
+        }
+        try {
+            report = child->report();
+        }
+        catch (Exception &e) {
+            BRANCH_ERR("branch %s: %s\n", name.c_str(), e.what());
+            status = 1;
+        }
+        catch (...) {
+            status = 1;
+        }
+        for (string::size_type done = 0; done < report.size() && !status; ) {
+            ssize_t n = write(fd[1], report.data() + done, report.size() - done);
+
+            if (n < 0 && errno != EINTR) {
+                status = 1;
+            }
+            done += n > 0 ? n : 0;
+        }
+        cout.flush();
+        fflush(NULL);
+        _exit(status);
+    }
+
+    close(fd[1]);
+    branch->pipe_ = fd[0];
+    branch_.push_back(branch);
+    running_++;
+    BRANCH_TRACE("branch %s is pid %d\n", name.c_str(), (int)branch->pid_);
+    return branch;
+}
+
+/**
+ * runningIs:
+ *
+ * collect reports until no more than n branches are running
+ */
+
+void
+Branch::Manager::runningIs(unsigned int n)
+{
+    while (running_ > n) {
+        collect();
+    }
+}
+
+/**
+ * collect:
+ *
+ * wait for output from any running branch.  All pipes are read as
+ * they fill, a branch never blocks on a report nobody reads.
+ */
+
+void
+Branch::Manager::collect()
+{
+    vector<struct pollfd> fds;
+    vector<Branch *> owner;
+    char buf[4096];
+
+    for (unsigned int i = 0; i < branch_.size(); i++) {
+        if (branch_[i]->pipe_ >= 0) {
+            struct pollfd p;
+
+            p.fd = branch_[i]->pipe_;
+            p.events = POLLIN;
+            p.revents = 0;
+            fds.push_back(p);
+            owner.push_back(branch_[i].value());
+        }
+    }
+    if (poll(&fds[0], fds.size(), -1) < 0) {
+        if (errno == EINTR) {
+            return;
+        }
+        throw ResourceException("cannot wait for a branch");
+    }
+
+    for (unsigned int i = 0; i < fds.size(); i++) {
+        if (!fds[i].revents) {
+            continue;
+        }
+        ssize_t n = read(fds[i].fd, buf, sizeof(buf));
+        if (n > 0) {
+            owner[i]->report_.append(buf, n);
+        } else if (n == 0 || errno != EINTR) {
+            finish(owner[i]);
+        }
+    }
+}
+
+/**
+ * finish:
+ *
+ * the branch closed its pipe, reap it
+ */
+
+void
+Branch::Manager::finish(Branch *branch)
+{
+    int status;
+
+    close(branch->pipe_);
+    branch->pipe_ = -1;
+    while (waitpid(branch->pid_, &status, 0) < 0) {
+        if (errno != EINTR) {
+            status = -1;
+            break;
+        }
+    }
+    if (status != -1 && WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        branch->status_ = Branch::Finished;
+    } else {
+        branch->status_ = Branch::Failed;
+        BRANCH_ERR("branch %s failed\n", branch->name().c_str());
+    }
+    running_--;
+}
+
+/* end of file */
@@ -0,0 +1,107 @@
+/*
+ * $Id: Branch.h,v 1.1 2005/12/05 02:07:19 fzb Exp $
+ *
+ * Branch.h -- what-if runs forked off a live simulation
+ *
+ * Fritz Budiyanto, December 2005
+ *
+ */
+
+#ifndef __BRANCH_H__
+#define __BRANCH_H__
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+#include "PtrInterface.h"
+#include "Ptr.h"
+#include "Exception.h"
+#include "Simulation.h"
+
+using namespace std;
+
+/**
+ * Branch:
+ *
+ * a child process forked off the simulation as it stands.  It starts
+ * from a copy on write image of the parent, so the network and its
+ * Activity::Manager come along for free; its Child applies a change,
+ * runs ahead and returns a report, which the parent reads back over
+ * a pipe.  A branch whose child throws, or that dies, has Failed.
+ */
+class Branch : public PtrInterface<Branch> {
+public:
+    // Types
+    typedef Ptr<Branch> Ptr;
+    enum Status {Running,Finished,Failed};
+    class Manager;
+    class Child {
+    public:
+        virtual string report() = 0;    // runs in the forked process
+
+        virtual ~Child() {}
+    };
+
+    // Accessor
+    string  name() const { return name_; }
+    Status  status() const { return status_; }
+    string  report() const { return report_; }
+    pid_t   pid() const { return pid_; }
+
+private:
+    friend class Manager;
+
+    string  name_;
+    Status  status_;
+    string  report_;
+    pid_t   pid_;
+    int     pipe_;      // read end, -1 once drained
+
+    Branch(const string &name)
+        :name_(name), status_(Running), pid_(-1), pipe_(-1) {}
+};
+
+/**
+ * Branch::Manager:
+ *
+ * forks branches and collects their reports.  No more than
+ * concurrency() of them run at once, branchNew waits for one to end
+ * when it would go beyond.  runningIs(n) waits until at most n are
+ * still running, runningIs(0) collects all of them.  A simulation
+ * on a partitioned Activity::Manager cannot be branched, its threads
+ * would not follow into the child.
+ */
+class Branch::Manager : public PtrInterface<Branch::Manager> {
+public:
+    // Accessor
+    unsigned int    branches() const { return branch_.size(); }
+    Ptr<Branch>     branch(unsigned int index) const;
+    Ptr<Branch>     branch(const string &name) const;
+    unsigned int    running() const { return running_; }
+    unsigned int    concurrency() const { return concurrency_; }
+
+    // Mutator
+    Ptr<Branch>     branchNew(const string &name, Branch::Child *child);
+    void            runningIs(unsigned int n);
+    void            concurrencyIs(unsigned int n);
+
+    // Constructor/Destructor
+    Manager(Ptr<Simulation> simulation);
+    ~Manager();
+
+private:
+    Ptr<Simulation>         simulation_;
+    vector<Ptr<Branch> >    branch_;
+    unsigned int            running_;
+    unsigned int            concurrency_;
+
+    void collect();
+    void finish(Branch *branch);
+};
+
+#include "Ptr.in"
+
+#endif /* __BRANCH_H__ */
+
+/* end of file */
@@ -9,6 +9,7 @@
 
 #include <iostream>
 #include <vector>
+#include <map>
 #include "Gore.h"
 #include "Notifiee.h"
 #include "Log.h"
@@ -26,15 +27,222 @@ logGore.entryNew(Log::Error, this->name(), __FUNCTION__, format, ##args)
 #define GORE_TRACE(format, args...) \
 logGore.entryNew(Log::Debug, this->name(), __FUNCTION__, format, ##args)
 
-Interface::Interface(string name) 
+/**
+ * transmitTime:
+ *
+ * serialization time of a packet of size bytes on a link running at
+ * rate Mbps, in whole nanosecond (bytes * 8 bits * 1000 / Mbps).
+ * rate must be non-zero.
+ */
+static inline Time
+transmitTime(Packet::Size size, unsigned int rate)
+{
+    return Time((int64_t)size.value() * 8 * 1000 / rate);
+}
+
+/**
+ * lookaheadCheck:
+ *
+ * a link between interfaces on two partitions carries its packets as
+ * timers posted across, each way needs a propagation delay of at
+ * least the lookahead.  Refused here, a short link would otherwise
+ * only show up once a packet is already on it.
+ */
+static void
+lookaheadCheck(const Ptr<Simulation> &simulation, 
+               const Activity::Manager *m0, Time delay0,
+               const Activity::Manager *m1, Time delay1)
+{
+    Time lookahead = simulation->activityManager()->lookahead();
+
+    if (m0 != m1 && (delay0 < lookahead || delay1 < lookahead)) {
+        throw PermissionException("link between partitions is shorter than the lookahead");
+    }
+}
+
+/**
+ * Interface::Delivery:
+ *
+ * a packet arriving at the other side after the propagation delay,
+ * when both sides run on the same manager.  The packet waits on the
+ * sender's wire under the delivery key.
+ */
+class Interface::Delivery {
+public:
+    void operator()();
+
+    Delivery(Interface *source, Interface *target, unsigned long long key) 
+        :source_(source), target_(target), key_(key) {}
+
+private:
+    WeakPtr<Interface>  source_;
+    WeakPtr<Interface>  target_;
+    unsigned long long  key_;
+};
+
+/**
+ * Interface::Transfer:
+ *
+ * a packet arriving at an interface of another partition.  The
+ * descriptor travels by value, nothing of the partition that sent
+ * it is touched on arrival.  The target is looked up by ordinal when
+ * the packet arrives, one deleted in the meantime does not get it.
+ */
+class Interface::Transfer {
+public:
+    void operator()() {
+        Interface *target = simulation_->interface(ordinal_);
+        if (target) {
+            target->lastInputPacketIs(packet_);
+        }
+    }
+
+    Transfer(Simulation *simulation, unsigned int ordinal, 
+             const Packet::Descriptor &packet) 
+        :simulation_(simulation), ordinal_(ordinal), packet_(packet) {}
+
+private:
+    Ptr<Simulation>     simulation_;
+    unsigned int        ordinal_;
+    Packet::Descriptor  packet_;
+};
+
+/**
+ * Restore:
+ *
+ * puts a value back when the event that changed it is rolled back
+ */
+template<class T> class Restore {
+public:
+    void operator()() { *where_ = value_; }
+
+    Restore(T *where) :where_(where), value_(*where) {}
+
+private:
+    T   *where_;
+    T   value_;
+};
+
+/**
+ * journal:
+ *
+ * save *where before a speculative event changes it
+ */
+template<class T> static inline void
+journal(Activity::Manager *manager, T *where)
+{
+    if (manager->speculative()) {
+        manager->undoIs(Restore<T>(where));
+    }
+}
+
+/**
+ * PushBackUndo, EraseUndo:
+ *
+ * take back one change to a packet queue or wire.  Only the packet
+ * that moved is kept, the cost of a speculative event does not grow
+ * with the queue.  Undo runs newest first, so the queue is back as
+ * the change left it when its record runs.
+ */
+template<class Q> class PushBackUndo {
+public:
+    void operator()() { where_->pop_back(); }
+
+    PushBackUndo(Q *where) :where_(where) {}
+
+private:
+    Q   *where_;
+};
+
+template<class Q> class EraseUndo {
+public:
+    void operator()() { where_->insert(where_->begin() + index_, value_); }
+
+    EraseUndo(Q *where, typename Q::iterator i) 
+        :where_(where), index_(i - where->begin()), value_(*i) {}
+
+private:
+    Q                       *where_;
+    typename Q::size_type   index_;
+    typename Q::value_type  value_;
+};
+
+/**
+ * journalPushBack, journalErase:
+ *
+ * note a push_back onto *where, or the erasing of i from it, before
+ * a speculative event makes it
+ */
+template<class Q> static inline void
+journalPushBack(Activity::Manager *manager, Q *where)
+{
+    if (manager->speculative()) {
+        manager->undoIs(PushBackUndo<Q>(where));
+    }
+}
+
+template<class Q> static inline void
+journalErase(Activity::Manager *manager, Q *where, typename Q::iterator i)
+{
+    if (manager->speculative()) {
+        manager->undoIs(EraseUndo<Q>(where, i));
+    }
+}
+
+/**
+ * operator():
+ *
+ * take the packet off the wire, it is normally the first one.  The
+ * packet is lost with either interface.
+ */
+
+void
+Interface::Delivery::operator()()
+{
+    Interface *source = source_.value();
+    Interface *target = target_.value();
+
+    if (!source || !target) {
+        return;
+    }
+    deque<Interface::Wire> &wire = source->wire_;
+    deque<Interface::Wire>::iterator i = wire.begin();
+
+    while (i != wire.end() && i->key != key_) {
+        ++i;
+    }
+    if (i == wire.end()) {
+        return;
+    }
+    Packet::Descriptor packet = i->packet;
+
+    journalErase(source->manager_.value(), &wire, i);
+    wire.erase(i);
+    target->lastInputPacketIs(packet);
+}
+
+/*
+ * every interface of a simulation gets an ordinal, it keys the
+ * deliveries posted by the interface so that packets arriving at the
+ * same time are taken in the same order however the network is
+ * partitioned
+ */
+Interface::Interface(string name, Ptr<Simulation> simulation) 
     :NamedObject(name), 
+    notifiee_(NULL),
     otherSide_(NULL), 
     filters_(0),
     queueSize_(10),
     packetsReceived_(0),
     packetsDropped_(0),
-    activity_(ActivityManager()->activityNew(name + string(" transmit packet")))
+    simulation_(simulation),
+    manager_(simulation->activityManager()),
+    activity_(manager_->activityNew()),
+    propagationDelay_(),
+    ordinal_(simulation->interfaceOrdinalNew(this)),
+    deliveries_(0)
 {
+    activity_->labelIs("transmit packet");
     reactor_ = new InterfaceReactor(this);
     if (!reactor_) {
         throw ResourceException();
@@ -54,10 +262,61 @@ Interface::nodeIs(Ptr<Node> n)
     node_ = n;
 }
 
+/**
+ * managerIs:
+ *
+ * move the interface to another Activity::Manager, its transmit
+ * activity is recreated there.  Only an idle interface can move,
+ * and not away from its other side over a link shorter than the
+ * lookahead.
+ */
+
+void
+Interface::managerIs(Ptr<Activity::Manager> manager)
+{
+    if (manager == manager_) {
+        return;
+    }
+    if (!queue_.empty() || activity_->nextTime() != Activity::Never) {
+        throw PermissionException("cannot move a busy interface");
+    }
+    if (otherSide_) {
+        lookaheadCheck(simulation_, manager.value(), propagationDelay_,
+                       otherSide_->manager_.value(), otherSide_->propagationDelay_);
+    }
+
+    manager_->activityDel(activity_->handle());
+    manager_ = manager;
+    activity_ = manager_->activityNew();
+    activity_->labelIs("transmit packet");
+}
+
+/**
+ * propagationDelayIs:
+ *
+ * time a packet takes to reach the other side once it is on the
+ * wire.  A link between two partitions needs a delay of at least
+ * the parallel manager's lookahead.
+ */
+
+void
+Interface::propagationDelayIs(Time delay)
+{
+    if (delay < Time()) {
+        throw RangeException();
+    }
+    if (otherSide_) {
+        lookaheadCheck(simulation_, manager_.value(), delay,
+                       otherSide_->manager_.value(), otherSide_->propagationDelay_);
+    }
+    propagationDelay_ = delay;
+}
+
 /**
  * otherSideIs:
  *
- * link the interface's otherSide to 'intf'
+ * link the interface's otherSide to 'intf', across partitions only
+ * over a link no shorter than the lookahead
  */
 
 void 
@@ -69,6 +328,10 @@ Interface::otherSideIs(Ptr<Interface> intf)
     if (intf.value() == this) {
         throw PermissionException("cannot link interface to itself");
     }
+    if (intf) {
+        lookaheadCheck(simulation_, manager_.value(), propagationDelay_,
+                       intf->manager_.value(), intf->propagationDelay_);
+    }
 
     /*
      * unlink the other side's interface to me
@@ -89,37 +352,77 @@ Interface::otherSideIs(Ptr<Interface> intf)
 /**
  * ~Interface:
  *
- * node node to point to nowhere
- * disconnect otherSide's connection to me
  * disconnect otherSide
+ * release the transmit activity and the ordinal
  */
 
 Interface::~Interface() 
 {
     try {
 
-    Ptr<Interface> otherSide = this->otherSide();
-    if (otherSide) {
-        otherSide->otherSideIs(NULL);
-    }
     otherSideIs(NULL);
-    nodeIs(NULL);
+    manager_->activityDel(activity_->handle());
+    if (simulation_->interface(ordinal_) == this) {
+        simulation_->interfaceOrdinalDel(ordinal_);
+    }
 
     }
     catch (...) {}
 }
 
+/**
+ * handleNotification:
+ *
+ * the packet at the head of the queue is on the wire.  Without a
+ * propagation delay the other side gets it right away, otherwise
+ * its arrival is posted to the other side's manager.
+ */
+
 void 
 InterfaceReactor::handleNotification (Activity *a) 
 {
     GORE_TRACE("\n");
     Ptr<Interface> intf = notifier();
-    Ptr<Packet> packet = notifier()->queue_.front();
+    Activity::Manager *manager = intf->manager_.value();
+    Packet::Descriptor packet = intf->queue_.front();
 
-    intf->queue_.erase(intf->queue_.begin());
+    journalErase(manager, &intf->queue_, intf->queue_.begin());
+    intf->queue_.pop_front();
 
-    Ptr<Interface> otherSide = intf->otherSide();
-    otherSide->lastInputPacketIs(packet);
+    /*
+     * the other side may belong to another partition, do not touch
+     * its reference count.  A packet sent down a failed link is lost.
+     */
+    Interface *otherSide = intf->otherSide_.value();
+    if (!otherSide) {
+        journal(manager, &intf->packetsDropped_);
+        ++intf->packetsDropped_;
+    } else if (intf->propagationDelay_ == Time() && 
+        otherSide->manager_ == intf->manager_) {
+        otherSide->lastInputPacketIs(packet);
+    } else {
+        Time arrival = manager->now() + intf->propagationDelay_;
+
+        journal(manager, &intf->deliveries_);
+        unsigned long long key = 
+            ((unsigned long long)intf->ordinal_ << 32) | intf->deliveries_++;
+
+        if (otherSide->manager_ == intf->manager_) {
+            journalPushBack(manager, &intf->wire_);
+            intf->wire_.push_back(Interface::Wire());
+
+            Interface::Wire &wire = intf->wire_.back();
+            wire.arrival = arrival;
+            wire.key = key;
+            wire.packet = packet;
+            manager->timerPost(manager, arrival, key, 
+                               Interface::Delivery(intf.value(), otherSide, key));
+        } else {
+            manager->timerPost(otherSide->manager_.value(), arrival, key, 
+                               Interface::Transfer(intf->simulation_.value(), 
+                                                   otherSide->ordinal_, packet));
+        }
+    }
 
     /*
      * schedule another one until we drain all queue
@@ -136,10 +439,13 @@ InterfaceReactor::onQueue ()
     /*
      * schedule a transmit
      */
-    Ptr<Packet> packet = intf->queue_.front();
+    const Packet::Descriptor &packet = intf->queue_.front();
 
-    Time packetTransmitTime((1000000000.0 * packet->size().value() * 8.0) / (intf->dataRate().value() * 1000000.0));
-    packetTransmitTime += ActivityManager()->now();
+    Time packetTransmitTime = Activity::Never;
+    if (intf->dataRate().value() > 0) {
+        packetTransmitTime = intf->manager_->now() +
+            transmitTime((int)packet.size, intf->dataRate().value());
+    }
 
     Ptr<Activity> act = activity();
     act->nextTimeIs(packetTransmitTime);
@@ -148,17 +454,19 @@ InterfaceReactor::onQueue ()
 
 
 void
-Interface::lastOutputPacketIs(Ptr<Packet> packet)
+Interface::lastOutputPacketIs(const Packet::Descriptor &packet)
 {
 
     GORE_TRACE("packetsDropped_: %d\n", packetsDropped_.value());
     if (queue_.size() == queueSize().value()) {
+        journal(manager_.value(), &packetsDropped_);
         ++packetsDropped_;
         /*
          * drop em
          */
         return;
     }
+    journalPushBack(manager_.value(), &queue_);
     queue_.push_back(packet);
 
     /*
@@ -170,13 +478,26 @@ Interface::lastOutputPacketIs(Ptr<Packet> packet)
     catch(...) {}
 }
 
+/**
+ * lastInputPacketIs:
+ *
+ * the packet is a copy of its own, its age is decremented in place.
+ * A rolled back event gets the packet back from the journal of the
+ * queue or wire it came from, age included.
+ */
+
 void
-Interface::lastInputPacketIs(Ptr<Packet> packet)
+Interface::lastInputPacketIs(Packet::Descriptor packet)
 {
     GORE_TRACE("packetsDropped_: %d\n", packetsDropped_.value());
+    Activity::Manager *manager = manager_.value();
+    Node *node = node_.value();
+
+    journal(manager, &packetsReceived_);
     ++packetsReceived_;
 
-    if (packet->age() <= Packet::Age::Min) {
+    if (packet.age <= Packet::Age::Min) {
+        journal(manager, &packetsDropped_);
         ++packetsDropped_;
         return;
     }
@@ -184,17 +505,18 @@ Interface::lastInputPacketIs(Ptr<Packet> packet)
     /*
      * decrement packet age
      */
-    packet->ageDec();
+    --packet.age;
 
     /*
      * if this packet is not for us, then 
      * check if there is such route
      */
-    if (packet->destination() != node().value()) {
+    if (packet.destination != node->id()) {
         /*
          * if there is no route, drop and count
          */
-        if (!(node()->route(packet->destination()))) {
+        if (!node->nextHop(packet.destination)) {
+            journal(manager, &packetsDropped_);
             ++packetsDropped_;
             return;
         }
@@ -203,7 +525,7 @@ Interface::lastInputPacketIs(Ptr<Packet> packet)
     /*
      * let node process the packet
      */
-    node()->lastPacketIs(packet);
+    node->lastPacketIs(packet);
 }
 
 /**
@@ -216,21 +538,21 @@ Interface::lastInputPacketIs(Ptr<Packet> packet)
  */
 
 void 
-Node::lastPacketIs(Ptr<Packet> packet)
+Node::lastPacketIs(const Packet::Descriptor &packet)
 {
     /*
      * received a packet
      */
-    Ptr<Interface> outgoingIntf;
+    Interface *outgoingIntf;
 
     /*
      * packet for me?
      */
-    if (packet->destination() == this) {
+    if (packet.destination == id_) {
         return;
     }
 
-    outgoingIntf = route(packet->destination());
+    outgoingIntf = nextHop(packet.destination);
     if (!outgoingIntf) {
         return;
     }
@@ -397,7 +719,7 @@ void
 Node::spf (vector<SPF> &candidate)
 {
     SPF elem;
-    map<Node *, Slot>::iterator rt;
+    map<unsigned int, Slot>::iterator rt;
     
     while (!candidate.empty()) {
         elem = candidate.front();
@@ -406,12 +728,12 @@ Node::spf (vector<SPF> &candidate)
         /*
          * what out for existing element
          */
-        rt = routeTable_.find(elem.host);
+        rt = routeTable_.find(elem.host->id_);
         if (rt != routeTable_.end()) {
             continue;
         }
 
-        routeTable_[elem.host] = elem.slot;
+        routeTable_[elem.host->id_] = elem.slot;
 
         vector<Ptr<Node> > neighbors;
         neighbors = elem.host->directNeighbor();
@@ -425,7 +747,7 @@ Node::spf (vector<SPF> &candidate)
              nodeIterator < neighbors.end();
              nodeIterator++) {
             Ptr<Node> node = (*nodeIterator);
-            rt = routeTable_.find(node.value());
+            rt = routeTable_.find(node->id_);
             if (rt != routeTable_.end()) {
                 continue;
             }
@@ -446,7 +768,7 @@ Node::routeUpdate (void)
     /*
      * add ourself to the routing table
      */
-    routeTable_[this] = Slot();
+    routeTable_[id_] = Slot();
 
     for (unsigned int i = 0; i < interface_.size(); i++) {
         Ptr<Interface> otherSide = interface_[i]->otherSide();
@@ -468,30 +790,40 @@ Node::routeUpdate (void)
     /*
      * remove ourself from the routing table so that packet wont be looping
      */
-    map<Node *, Slot>::iterator rt;
-    rt = routeTable_.find(this);
+    map<unsigned int, Slot>::iterator rt;
+    rt = routeTable_.find(id_);
     if (rt != routeTable_.end()) {
         routeTable_.erase(rt);
     }
 }
 
 Ptr<Interface> 
-Node::route(Ptr<Node> dest) const
+Node::route(Node *dest) const
 {
     if (!dest) {
         return NULL;
     }
+    return nextHop(dest->id_);
+}
 
-    map<Node *, Slot>::const_iterator rt = routeTable_.find(dest.value());
+/**
+ * nextHop:
+ *
+ * the interface toward the node of the given id, NULL if there is no
+ * route.  Packets are forwarded through it without a reference to
+ * the interface being taken.
+ */
+
+Interface *
+Node::nextHop(unsigned int id) const
+{
+    map<unsigned int, Slot>::const_iterator rt = routeTable_.find(id);
 
     /*
      * if route found, return it
      */
-    if (rt != routeTable_.end()) {
-        Slot slot;
-
-        slot = (*rt).second;
-        return interface(slot);
+    if (rt != routeTable_.end() && rt->second.value() < interface_.size()) {
+        return interface_[rt->second.value()].value();
     }
 
     return NULL;
@@ -509,9 +841,10 @@ void
 Node::addInterface(Slot slot, Ptr<Interface> intf)
 {
     /*
-     * link to ourself
+     * link to ourself, the interface runs on our manager
      */
     intf->nodeIs(this);
+    intf->managerIs(manager_);
 
     /*
      * adding an interface ?
@@ -553,26 +886,73 @@ Node::deleteInterface(Slot slot)
     interface_.erase(i);
 }
 
+/**
+ * partitionIs:
+ *
+ * run the node and its interfaces on the given partition of the
+ * Activity::Manager
+ */
+
+void
+Node::partitionIs(unsigned int partition)
+{
+    if (partition == partition_) {
+        return;
+    }
+
+    Ptr<Activity::Manager> manager = simulation_->activityManager()->partition(partition);
+    if (!manager) {
+        throw RangeException();
+    }
+    managerIs(manager);
+    partition_ = partition;
+}
+
+/**
+ * managerIs:
+ *
+ * move the node and all its interfaces to manager.  If one of
+ * them cannot move, those already moved go back.
+ */
+
+void
+Node::managerIs(Ptr<Activity::Manager> manager)
+{
+    unsigned int i = 0;
+
+    try {
+        for (; i < interface_.size(); i++) {
+            interface_[i]->managerIs(manager);
+        }
+    }
+    catch (...) {
+        while (i-- > 0) {
+            interface_[i]->managerIs(manager_);
+        }
+        throw;
+    }
+    manager_ = manager;
+}
+
 /**
  * ~Node:
  *
  * iterate each interface, and delink them to the node,
- * and delete them from the interface list
+ * the interface list lets go of them
  */
 
 Node::~Node() 
 {
     try {
 
-    vector<Ptr<Interface> >::iterator i;
-    for (i = interface_.begin(); i < interface_.end(); i++) {
-        Ptr<Interface> intf = *i;
-        intf->nodeIs(NULL);
-        interface_.erase(i);
+    for (unsigned int i = 0; i < interface_.size(); i++) {
+        interface_[i]->nodeIs(NULL);
     } 
 
     }
     catch (...) {}
+
+    simulation_->nodeIdDel(id_);
 }
 
 
@@ -653,7 +1033,7 @@ EthernetInterface::otherSideIs (Ptr<Interface> intf)
         throw PermissionException("Trying to connect non EthernetInterface "
                                   "to an EthernetInterface");
     }
-    if (intf->dataRate() != dataRate()) {
+    if (intf && intf->dataRate() != dataRate()) {
         throw PermissionException("connecting an incompatible "
                                   "EthernetInterface data rate");
     }
@@ -703,20 +1083,99 @@ EthernetSwitch::interfaceIs (Slot slot, Ptr<Interface> intf)
     Node::interfaceIs(slot, intf);
 }
 
+/**
+ * descriptorNew:
+ *
+ * a packet of size from src to dest, either may be NULL, not sent
+ * yet and of the default age
+ */
+
+Packet::Descriptor
+Packet::descriptorNew(Size size, Node *src, Node *dest)
+{
+    Descriptor d;
+
+    d.timestamp = Time().value();
+    d.source = src ? src->id() : 0;
+    d.destination = dest ? dest->id() : 0;
+    d.size = size.value();
+    d.age = Age().value();
+    return d;
+}
+
+Packet::Packet(Size size, Node *src, Node *dest)
+    :simulation_(src ? src->simulation() : dest ? dest->simulation() : Ptr<Simulation>()),
+     descriptor_(descriptorNew(size, src, dest))
+{
+}
+
+Node *
+Packet::source() const
+{
+    return simulation_ ? simulation_->node(descriptor_.source) : NULL;
+}
+
+Node *
+Packet::destination() const
+{
+    return simulation_ ? simulation_->node(descriptor_.destination) : NULL;
+}
 
-IPHost::IPHost(string nameString) :Node(nameString),
+IPHost::IPHost(string nameString, Ptr<Simulation> simulation) 
+                                   :Node(nameString, simulation),
                                    transmitRate_(0),
                                    packetSize_(0),
+                                   destination_(NULL),
+                                   notifiee_(NULL),
                                    sumLatency_(0),
-                                   activity_(ActivityManager()->activityNew(nameString + string(" packet generator"))),
+                                   activity_(manager_->activityNew()),
                                    packetCount_(0)
 {
+    activity_->labelIs("packet generator");
     reactor_ = new IPHostReactor(this);
     if (!reactor_) {
         throw ResourceException();
     }
 }
 
+/**
+ * ~IPHost:
+ *
+ * release the packet generator activity
+ */
+
+IPHost::~IPHost()
+{
+    try {
+        manager_->activityDel(activity_->handle());
+    }
+    catch (...) {}
+}
+
+/**
+ * managerIs:
+ *
+ * move the packet generator activity along with the node, it must
+ * not be scheduled yet.
+ */
+
+void
+IPHost::managerIs(Ptr<Activity::Manager> manager)
+{
+    if (manager == manager_) {
+        return;
+    }
+    if (activity_->nextTime() != Activity::Never) {
+        throw PermissionException("cannot move a transmitting host");
+    }
+
+    Ptr<Activity::Manager> old = manager_;
+    Node::managerIs(manager);
+    old->activityDel(activity_->handle());
+    activity_ = manager_->activityNew();
+    activity_->labelIs("packet generator");
+}
+
 /**
  * lastPacketIs:
  *
@@ -724,13 +1183,13 @@ IPHost::IPHost(string nameString) :Node(nameString),
  */
 
 void
-IPHost::lastPacketIs (Ptr<Packet> packet)
+IPHost::lastPacketIs (const Packet::Descriptor &packet)
 {
     /*
      * if we are sending the packet, let it go
      */
-    if (packet->source() == this &&
-        packet->destination() != this) {
+    if (packet.source == id() &&
+        packet.destination != id()) {
         /*
          * send the packet that originated from the host
          */
@@ -742,7 +1201,7 @@ IPHost::lastPacketIs (Ptr<Packet> packet)
      * drop the packet if it needs to be forwarded
      * to other host.
      */
-    if (packet->destination() != this) {
+    if (packet.destination != id()) {
         /*
          * drop silently
          */
@@ -752,12 +1211,14 @@ IPHost::lastPacketIs (Ptr<Packet> packet)
     /*
      * packet received
      */
+    journal(manager_.value(), &packetCount_);
     ++packetCount_;
 
     /* 
      * update latency
      */
-    sumLatency_ = Latency(sumLatency_.value() + (ActivityManager()->now() - packet->timestamp()).value());
+    journal(manager_.value(), &sumLatency_);
+    sumLatency_ = Latency(sumLatency_.value() + (manager_->now() - Time(packet.timestamp)).value());
 }
 
 IPHost::Latency                 
@@ -822,9 +1283,10 @@ IPHostReactor::handleNotification (Activity *act)
 
     GORE_TRACE("\n");
     host = notifier();
-    packet_->timestampIs(ActivityManager()->now());
+    journal(host->manager_.value(), &packet_);
+    packet_.timestamp = host->manager_->now().value();
     host->lastPacketIs(packet_);
-    packet_ = NULL;
+    packet_ = Packet::Descriptor();
 
     /*
      * schedule for next packet generation
@@ -854,11 +1316,11 @@ IPHostReactor::onGeneratePacket ()
     if ((packetSize.value() > 0) && 
         (rate.value() > 0) && 
         (host->destination() != NULL)) {
-        double timeoutValue = 1000000000.0 * packetSize.value() * 8 / (1000000 * host->transmitRate().value());
-        timeout = ActivityManager()->now() + Time(timeoutValue);
+        timeout = host->manager_->now() +
+                  transmitTime(packetSize, rate.value());
 
-        packet_ = new Packet(packetSize, host, host->destination());
-        if (!packet_) throw ResourceException();
+        journal(host->manager_.value(), &packet_);
+        packet_ = Packet::descriptorNew(packetSize, host.value(), host->destination());
     }
 
     Ptr<Activity> act = activity();
@@ -866,6 +1328,295 @@ IPHostReactor::onGeneratePacket ()
     act->timeoutNotifieeIs(this);
 }
 
+void
+Snapshot::nodeIs(Ptr<Node> node)
+{
+    nodeIndex_[node.value()] = node_.size();
+    node_.push_back(node);
+}
+
+void
+Snapshot::interfaceIs(Ptr<Interface> intf)
+{
+    interfaceIndex_[intf.value()] = interface_.size();
+    interface_.push_back(intf);
+}
+
+/*
+ * a node is saved as its position in node_ plus one, 0 for none
+ */
+void
+Snapshot::referenceIs(Ptr<Activity::Checkpoint> checkpoint, Node *node)
+{
+    map<Node *, unsigned int>::const_iterator i = nodeIndex_.find(node);
+
+    if (!node) {
+        checkpoint->integerIs(0);
+        return;
+    }
+    if (i == nodeIndex_.end()) {
+        throw PermissionException("cannot checkpoint a node it was not given");
+    }
+    checkpoint->integerIs(i->second + 1);
+}
+
+Node *
+Snapshot::reference(Ptr<Activity::Checkpoint> checkpoint) const
+{
+    unsigned long long index = checkpoint->integer();
+
+    if (index > node_.size()) {
+        throw RangeException();
+    }
+    return index ? node_[index - 1].value() : NULL;
+}
+
+void
+Snapshot::packetIs(Ptr<Activity::Checkpoint> checkpoint, const Packet::Descriptor &packet)
+{
+    checkpoint->integerIs(packet.size);
+    referenceIs(checkpoint, simulation_->node(packet.source));
+    referenceIs(checkpoint, simulation_->node(packet.destination));
+    checkpoint->timeIs(Time(packet.timestamp));
+    checkpoint->integerIs(packet.age);
+}
+
+Packet::Descriptor
+Snapshot::packet(Ptr<Activity::Checkpoint> checkpoint) const
+{
+    Packet::Size size = (int)checkpoint->integer();
+    Node *source = reference(checkpoint);
+    Node *destination = reference(checkpoint);
+    Packet::Descriptor packet = Packet::descriptorNew(size, source, destination);
+
+    packet.timestamp = checkpoint->time().value();
+    packet.age = (unsigned char)checkpoint->integer();
+    return packet;
+}
+
+/**
+ * snapshotIs:
+ *
+ * save the network, then its Activity::Manager.  Every interface
+ * must run on the simulation's manager.
+ */
+
+void
+Snapshot::snapshotIs(Ptr<Activity::Checkpoint> checkpoint)
+{
+    Ptr<Activity::Manager> manager = simulation_->activityManager();
+
+    checkpoint->integerIs(node_.size());
+    checkpoint->integerIs(interface_.size());
+
+    for (unsigned int i = 0; i < interface_.size(); i++) {
+        Interface *intf = interface_[i].value();
+        map<Interface *, unsigned int>::const_iterator otherSide;
+
+        if (intf->manager_ != manager) {
+            throw PermissionException("cannot checkpoint a partitioned network");
+        }
+        otherSide = interfaceIndex_.find(intf->otherSide_.value());
+        checkpoint->integerIs(intf->dataRate().value());
+        checkpoint->integerIs(intf->queueSize_.value());
+        checkpoint->integerIs(intf->filters_.value());
+        checkpoint->timeIs(intf->propagationDelay_);
+        checkpoint->integerIs(otherSide == interfaceIndex_.end() ? 0 : otherSide->second + 1);
+        checkpoint->integerIs(intf->ordinal_);
+        checkpoint->integerIs(intf->deliveries_);
+        checkpoint->integerIs(intf->packetsReceived_.value());
+        checkpoint->integerIs(intf->packetsDropped_.value());
+        checkpoint->integerIs(intf->activity_->handle());
+        checkpoint->integerIs(intf->queue_.size());
+        for (unsigned int j = 0; j < intf->queue_.size(); j++) {
+            packetIs(checkpoint, intf->queue_[j]);
+        }
+        checkpoint->integerIs(intf->wire_.size());
+        for (unsigned int j = 0; j < intf->wire_.size(); j++) {
+            checkpoint->timeIs(intf->wire_[j].arrival);
+            checkpoint->integerIs(intf->wire_[j].key);
+            packetIs(checkpoint, intf->wire_[j].packet);
+        }
+    }
+
+    for (unsigned int i = 0; i < node_.size(); i++) {
+        Node *node = node_[i].value();
+        IPHost *host = dynamic_cast<IPHost *>(node);
+
+        checkpoint->integerIs(node->interface_.size());
+        for (unsigned int j = 0; j < node->interface_.size(); j++) {
+            map<Interface *, unsigned int>::const_iterator index;
+
+            index = interfaceIndex_.find(node->interface_[j].value());
+            if (index == interfaceIndex_.end()) {
+                throw PermissionException("cannot checkpoint an interface it was not given");
+            }
+            checkpoint->integerIs(index->second);
+        }
+        checkpoint->integerIs(node->routeTable_.size());
+        map<unsigned int, Node::Slot>::const_iterator route;
+        for (route = node->routeTable_.begin(); route != node->routeTable_.end(); route++) {
+            referenceIs(checkpoint, simulation_->node(route->first));
+            checkpoint->integerIs(route->second.value());
+        }
+
+        checkpoint->integerIs(host != NULL);
+        if (!host) {
+            continue;
+        }
+        checkpoint->integerIs(host->transmitRate_.value());
+        checkpoint->integerIs(host->packetSize_.value());
+        referenceIs(checkpoint, host->destination_);
+        checkpoint->integerIs(host->packetCount_.value());
+        checkpoint->realIs(host->sumLatency_.value());
+        checkpoint->integerIs(host->activity_->handle());
+        checkpoint->integerIs(host->reactor_->packet_.destination != 0);
+        if (host->reactor_->packet_.destination) {
+            packetIs(checkpoint, host->reactor_->packet_);
+        }
+    }
+
+    manager->snapshotIs(checkpoint);
+}
+
+/**
+ * restoreIs:
+ *
+ * set up the nodes and interfaces handed over, all of them freshly
+ * made and unlinked, as saved in checkpoint.  Deliveries still on
+ * the wire are posted again once the manager is restored.
+ */
+
+void
+Snapshot::restoreIs(Ptr<Activity::Checkpoint> checkpoint)
+{
+    Ptr<Activity::Manager> manager = simulation_->activityManager();
+    vector<unsigned int> otherSide;
+
+    if (checkpoint->integer() != node_.size() || 
+        checkpoint->integer() != interface_.size()) {
+        throw RangeException();
+    }
+
+    /*
+     * the interfaces take back their saved ordinals, let go of the
+     * ones they were made with first
+     */
+    for (unsigned int i = 0; i < interface_.size(); i++) {
+        simulation_->interfaceOrdinalDel(interface_[i]->ordinal_);
+    }
+
+    for (unsigned int i = 0; i < interface_.size(); i++) {
+        Interface *intf = interface_[i].value();
+
+        intf->dataRateIs(checkpoint->integer());
+        intf->queueSizeIs(checkpoint->integer());
+        intf->filtersIs(checkpoint->integer());
+        intf->propagationDelayIs(checkpoint->time());
+        otherSide.push_back(checkpoint->integer());
+        if (otherSide.back() > interface_.size()) {
+            throw RangeException();
+        }
+        intf->ordinal_ = checkpoint->integer();
+        simulation_->interfaceOrdinalIs(intf->ordinal_, intf);
+        intf->deliveries_ = checkpoint->integer();
+        intf->packetsReceived_ = checkpoint->integer();
+        intf->packetsDropped_ = checkpoint->integer();
+        checkpoint->activityIs(checkpoint->integer(), intf->activity_);
+        intf->queue_.resize(checkpoint->integer());
+        for (unsigned int j = 0; j < intf->queue_.size(); j++) {
+            intf->queue_[j] = packet(checkpoint);
+        }
+        intf->wire_.resize(checkpoint->integer());
+        for (unsigned int j = 0; j < intf->wire_.size(); j++) {
+            intf->wire_[j].arrival = checkpoint->time();
+            intf->wire_[j].key = checkpoint->integer();
+            intf->wire_[j].packet = packet(checkpoint);
+        }
+    }
+
+    /*
+     * links are made once both sides have their data rate
+     */
+    for (unsigned int i = 0; i < interface_.size(); i++) {
+        if (otherSide[i] > i + 1) {
+            interface_[i]->otherSideIs(interface_[otherSide[i] - 1]);
+        }
+    }
+
+    for (unsigned int i = 0; i < node_.size(); i++) {
+        Node *node = node_[i].value();
+        IPHost *host = dynamic_cast<IPHost *>(node);
+        unsigned long long interfaces = checkpoint->integer();
+
+        for (unsigned int j = 0; j < interfaces; j++) {
+            unsigned long long index = checkpoint->integer();
+
+            if (index >= interface_.size()) {
+                throw RangeException();
+            }
+            node->interfaceIs(j, interface_[index]);
+        }
+        unsigned long long routes = checkpoint->integer();
+        node->routeTable_.clear();
+        for (unsigned int j = 0; j < routes; j++) {
+            Node *destination = reference(checkpoint);
+
+            if (!destination) {
+                throw RangeException();
+            }
+            node->routeTable_[destination->id()] = Node::Slot(checkpoint->integer());
+        }
+
+        if (!checkpoint->integer()) {
+            if (host) {
+                throw RangeException();
+            }
+            continue;
+        }
+        if (!host) {
+            throw RangeException();
+        }
+
+        /*
+         * the generator state is set directly, the activity is
+         * scheduled by the manager's restore
+         */
+        host->transmitRate_ = (int)checkpoint->integer();
+        host->packetSize_ = (int)checkpoint->integer();
+        host->destination_ = reference(checkpoint);
+        host->packetCount_ = checkpoint->integer();
+        host->sumLatency_ = checkpoint->real();
+        checkpoint->activityIs(checkpoint->integer(), host->activity_);
+        host->reactor_->packet_ = Packet::Descriptor();
+        if (checkpoint->integer()) {
+            host->reactor_->packet_ = packet(checkpoint);
+        }
+    }
+
+    manager->restoreIs(checkpoint);
+
+    for (unsigned int i = 0; i < interface_.size(); i++) {
+        Interface *intf = interface_[i].value();
+
+        for (unsigned int j = 0; j < intf->wire_.size(); j++) {
+            manager->timerNew(intf->wire_[j].arrival, intf->wire_[j].key, 
+                              Interface::Delivery(intf, intf->otherSide_.value(), 
+                                                  intf->wire_[j].key));
+        }
+        if (intf->activity_->nextTime() != Activity::Never) {
+            intf->activity_->timeoutNotifieeIs(intf->reactor_);
+        }
+    }
+    for (unsigned int i = 0; i < node_.size(); i++) {
+        IPHost *host = dynamic_cast<IPHost *>(node_[i].value());
+
+        if (host && host->activity_->nextTime() != Activity::Never) {
+            host->activity_->timeoutNotifieeIs(host->reactor_);
+        }
+    }
+}
+
 } // namespace NetworkImpl
 
 /* end of file */
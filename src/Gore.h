@@ -13,20 +13,21 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <deque>
 #include <map>
 #include <limits.h>
 
 #include "PtrInterface.h"
 #include "Ptr.h"
+#include "WeakPtr.h"
 #include "Nominal.h"
 #include "Notifiee.h"
 #include "Activity.h"
+#include "Simulation.h"
 #include "Exception.h"
 
 using namespace std;
 
-extern Ptr<Activity::Manager> ActivityManager();
-
 namespace NetworkImpl {
 
 /**
@@ -49,7 +50,74 @@ private:
 
 class Node;
 class InterfaceReactor;
-class Packet;
+
+/**
+ * Packet:
+ *
+ * a packet as the glue layer sees it, a view over its Descriptor.
+ * Interfaces keep and forward descriptors by value, a Packet is only
+ * made for whoever asks for one.
+ */
+class Packet : public PtrInterface<Packet> {
+public:
+    // Types
+    class Age : public Numeric<class Age_, unsigned char> {
+    public:
+        static const unsigned Min = 1;
+        static const unsigned Default = 64;
+        Age() :Numeric<class Age_, unsigned char>(Default) {}
+        Age(unsigned char age) :Numeric<class Age_, unsigned char>(age) {}
+    };
+    class Size : public Nominal<class Size__, int> {
+    public:
+        static const unsigned Default = 0;
+
+        Size(int s) :Nominal<class Size__, int>(s) {
+            if (s < 0) {
+                throw RangeException();
+            }
+        }
+    };
+
+    /*
+     * the whole of a packet in 24 bytes: the nodes by their id, see
+     * Node::id, and the timestamp in nanoseconds.  It has nothing to
+     * free and no reference to count, a copy is a packet of its own.
+     */
+    struct Descriptor {
+        int64_t         timestamp;
+        unsigned int    source;
+        unsigned int    destination;
+        unsigned int    size;
+        unsigned char   age;
+    };
+
+    // Accessors
+    Size        size() const { return (int)descriptor_.size; }
+    Time        timestamp() const { return Time(descriptor_.timestamp); }
+    Node*       destination() const;
+    Node*       source() const;
+    Age         age() const { return descriptor_.age; }
+    const Descriptor &descriptor() const { return descriptor_; }
+
+    // Mutators
+    void        sizeIs(Size size) { descriptor_.size = size.value(); }
+    void        timestampIs (Time t) { descriptor_.timestamp = t.value(); }
+    void        ageIs(Age age) { descriptor_.age = age.value(); }
+    void        ageDec() { if (descriptor_.age == 0) throw ResourceException(); --descriptor_.age; }
+    void        descriptorIs(const Descriptor &d) { descriptor_ = d; }
+    static Descriptor descriptorNew(Size size, Node *src, Node *dest);
+
+    // Constructor/Destructor
+    Packet(Size size, Node *src, Node *dest);
+    Packet(Ptr<Simulation> simulation, const Descriptor &d)
+        :simulation_(simulation), descriptor_(d) {}
+
+private:
+    Ptr<Simulation> simulation_;    // whose node ids the descriptor names
+    Descriptor      descriptor_;
+};
+
 class Interface : public NamedObject {
 public:
     // Types
@@ -75,6 +143,9 @@ public:
     virtual QueueSize       queueSize() const { return queueSize_; }
     Notifiee                *notifiee() const { return notifiee_; }
     Ptr<Activity>           activity() const { return activity_; }
+    Ptr<Activity::Manager>  manager() const { return manager_; }
+    Ptr<Simulation>         simulation() const { return simulation_; }
+    Time                    propagationDelay() const { return propagationDelay_; }
 
     // Mutator
     virtual void            nodeIs(Ptr<Node>);
@@ -83,27 +154,51 @@ public:
     virtual void            filtersIs(FilterCount count) { filters_ = count; }
     virtual void            queueSizeIs(QueueSize size) { queueSize_ = size; }
     void                    notifieeIs(Notifiee *n) { notifiee_ = n; }
-    virtual void            lastOutputPacketIs(Ptr<Packet> packet);
-    virtual void            lastInputPacketIs(Ptr<Packet> packet);
+    virtual void            managerIs(Ptr<Activity::Manager> manager);
+    virtual void            propagationDelayIs(Time delay);
+    virtual void            lastOutputPacketIs(const Packet::Descriptor &packet);
+    virtual void            lastInputPacketIs(Packet::Descriptor packet);
+    void                    lastOutputPacketIs(const Ptr<Packet> &packet) { lastOutputPacketIs(packet->descriptor()); }
+    void                    lastInputPacketIs(const Ptr<Packet> &packet) { lastInputPacketIs(packet->descriptor()); }
 
     // Constructor/Destructor
     virtual ~Interface();
 
 protected:
-    Ptr<Node> node_;
-    Interface(string name);
+    WeakPtr<Node> node_;        // the node owns its interfaces
+    Interface(string name, Ptr<Simulation> simulation);
 
 private:
     friend class InterfaceReactor;
+    friend class Snapshot;
+    class Delivery;
+    class Transfer;
+
+    /*
+     * packet on its way to an other side run by the same manager,
+     * kept until its delivery so that a checkpoint can save it
+     */
+    struct Wire {
+        Time                arrival;
+        unsigned long long  key;
+        Packet::Descriptor  packet;
+    };
+
     Notifiee                *notifiee_;
-    Ptr<Interface>          otherSide_;
+    WeakPtr<Interface>      otherSide_;
     FilterCount             filters_;
     QueueSize               queueSize_;
     PacketCount             packetsReceived_;
     PacketCount             packetsDropped_;
-    vector<Ptr<Packet> >    queue_;
+    deque<Packet::Descriptor> queue_;
+    Ptr<Simulation>         simulation_;
+    Ptr<Activity::Manager>  manager_;
     Ptr<Activity>           activity_;
     Ptr<InterfaceReactor>   reactor_;
+    Time                    propagationDelay_;
+    unsigned int            ordinal_;       // orders deliveries due at the same time
+    unsigned int            deliveries_;
+    deque<Wire>             wire_;          // in delivery key order
 };
 
 class Interface::Notifiee : public BaseNotifiee<Interface> {
@@ -144,14 +239,20 @@ public:
     };
 
     // Accessor
+    unsigned int        id() const { return id_; }
     Ptr<Interface>      interface(Slot slot) const;
     vector<Ptr<Node> >  directNeighbor() const;
     vector<Ptr<Node> >  distanceNeighbor(Degree degree) const;
-    Ptr<Interface>      route(Ptr<Node> n) const;
+    Ptr<Interface>      route(Node *n) const;
+    unsigned int        partition() const { return partition_; }
+    Ptr<Activity::Manager> manager() const { return manager_; }
+    Ptr<Simulation>     simulation() const { return simulation_; }
 
     // Mutator
     virtual void        interfaceIs(Slot slot, Ptr<Interface> intf);
-    virtual void        lastPacketIs(Ptr<Packet> packet);
+    virtual void        lastPacketIs(const Packet::Descriptor &packet);
+    void                lastPacketIs(const Ptr<Packet> &packet) { lastPacketIs(packet->descriptor()); }
+    void                partitionIs(unsigned int partition);
 
     // Callback handler
     void                handleNetworkUpdate() { routeUpdate(); }
@@ -160,7 +261,16 @@ public:
     virtual ~Node();
 
 protected:
-    Node(string name) :NamedObject(name) { }
+    friend class Snapshot;
+    friend class Interface;
+    Ptr<Simulation>         simulation_;
+    Ptr<Activity::Manager>  manager_;
+
+    Node(string name, Ptr<Simulation> simulation) 
+        :NamedObject(name), simulation_(simulation), 
+        manager_(simulation->activityManager()), partition_(0),
+        id_(simulation->nodeIdNew(this)) { }
+    virtual void        managerIs(Ptr<Activity::Manager> manager);
 
 private:
     // Private types
@@ -172,10 +282,13 @@ private:
     };
 
     // Member variables
-    map<Node *, Slot>       routeTable_;
+    map<unsigned int, Slot> routeTable_;    // by destination id
     vector<Ptr<Interface> > interface_;
+    unsigned int            partition_;
+    unsigned int            id_;
 
     // Private member functions
+    Interface *nextHop(unsigned int id) const;
     void candidateAdd (vector<SPF> &candidate, SPF elem, Node *node);
     void routeUpdate (void);
     void spf(vector<SPF> &candidate);
@@ -186,51 +299,6 @@ private:
                           const Ptr<Node> node, Degree degree) const;
 };
 
-class Packet : public PtrInterface<Packet> {
-public:
-    // Types
-    class Age : public Numeric<class Age_, unsigned char> {
-    public:
-        static const unsigned Min = 1;
-        static const unsigned Default = 64;
-        Age() :Numeric<class Age_, unsigned char>(Default) {}
-    };
-    class Size : public Nominal<class Size__, int> {
-    public:
-        static const unsigned Default = 0;
-
-        Size(int s) :Nominal<class Size__, int>(s) {
-            if (s < 0) {
-                throw RangeException();
-            }
-        }
-    };
-
-    // Accessors
-    Size        size() const { return size_; }
-    Time        timestamp() const { return timestamp_; }
-    Node*       destination() const { return destination_; }
-    Node*       source() const { return source_; }
-    Age         age() const { return age_; }
-
-    // Mutators
-    void        sizeIs(Size size) { size_ = size; }
-    void        timestampIs (Time t) { timestamp_ = t; }
-    void        ageDec() { if (age_.value() == 0) throw ResourceException(); --age_; }
-
-    // Constructor/Destructor
-    Packet(Size size, Ptr<Node> src, Ptr<Node> dest) 
-        :destination_(dest.value()), source_(src.value()), size_(size) {}
-
-private:
-    Node*       destination_;
-    Node*       source_;
-    Size        size_;
-    Time        timestamp_;
-    Age         age_;
-};
-
-
 class ATMInterface : public Interface {
 public:
     // Accessor
@@ -241,7 +309,8 @@ public:
     void        otherSideIs(Ptr<Interface> intf);
 
     // Constructor/Destructor
-    ATMInterface(string name) :Interface(name) {}
+    ATMInterface(string name, Ptr<Simulation> simulation) 
+        :Interface(name, simulation) {}
 
 private:
     class ATMDataRate : public DataRate {
@@ -272,7 +341,8 @@ public:
     void        otherSideIs(Ptr<Interface> intf);
 
     // Constructor/Destructor
-    EthernetInterface(string name) :Interface(name) {}
+    EthernetInterface(string name, Ptr<Simulation> simulation) 
+        :Interface(name, simulation) {}
 
 private:
     // Private Types
@@ -299,13 +369,15 @@ private:
 class ATMSwitch : public Node {
 public:
     void interfaceIs(Slot slot, Ptr<Interface> intf);
-    ATMSwitch(string nameString) :Node(nameString) {}
+    ATMSwitch(string nameString, Ptr<Simulation> simulation) 
+        :Node(nameString, simulation) {}
 };
 
 class EthernetSwitch : public Node {
 public:
     void interfaceIs(Slot slot, Ptr<Interface> intf);
-    EthernetSwitch(string nameString) :Node(nameString) {}
+    EthernetSwitch(string nameString, Ptr<Simulation> simulation) 
+        :Node(nameString, simulation) {}
 };
 
 class IPHostReactor;
@@ -343,12 +415,19 @@ public:
     void                    packetSizeIs(Packet::Size size);
     void                    destinationIs(Ptr<Node> destination);
     void                    notifieeIs(Notifiee *n) { notifiee_ = n; }
-    void                    lastPacketIs (Ptr<Packet> packet);
+    void                    lastPacketIs (const Packet::Descriptor &packet);
+    using Node::lastPacketIs;
 
     // Constructor/Destructor
-    IPHost(string nameString);
+    IPHost(string nameString, Ptr<Simulation> simulation);
+    ~IPHost();
+
+protected:
+    void                    managerIs(Ptr<Activity::Manager> manager);
 
 private:
+    friend class IPHostReactor;
+    friend class Snapshot;
     TransmitRate            transmitRate_;
     Packet::Size            packetSize_;
     Node*                   destination_;
@@ -368,11 +447,12 @@ public:
     // used to generate packet when dest, rate, and size has valid value
 
     IPHostReactor(IPHost *host) 
-        :IPHost::Notifiee(host), packet_(NULL), owner_(host) {}
+        :IPHost::Notifiee(host), packet_(), owner_(host) {}
     string name() const { return "IPHostReactor"; }
 
 private:
-    Ptr<Packet>     packet_;
+    friend class Snapshot;
+    Packet::Descriptor packet_;     // to send next, none without a destination
     IPHost          *owner_;
 
     Ptr<Activity>   activity() const { return owner_->activity(); }
@@ -380,7 +460,42 @@ private:
 
 class IPRouter : public Node {
 public:
-    IPRouter(string nameString) :Node(nameString) {}
+    IPRouter(string nameString, Ptr<Simulation> simulation) 
+        :Node(nameString, simulation) {}
+};
+
+/**
+ * Snapshot:
+ *
+ * checkpoint of a network together with the Activity::Manager of
+ * its simulation: the links, route tables, interface queues and
+ * counters, the packets on the wire and the packet generators.
+ * Nodes and interfaces are handed over in the same order to save
+ * and to restore.  Restoring sets up freshly made ones the way the
+ * saved ones were, routes included, without running any routing.
+ */
+class Snapshot {
+public:
+    // Mutator
+    void    nodeIs(Ptr<Node> node);
+    void    interfaceIs(Ptr<Interface> intf);
+    void    snapshotIs(Ptr<Activity::Checkpoint> checkpoint);
+    void    restoreIs(Ptr<Activity::Checkpoint> checkpoint);
+
+    // Constructor/Destructor
+    Snapshot(Ptr<Simulation> simulation) :simulation_(simulation) {}
+
+private:
+    Ptr<Simulation>             simulation_;
+    vector<Ptr<Node> >          node_;
+    vector<Ptr<Interface> >     interface_;
+    map<Node *, unsigned int>   nodeIndex_;
+    map<Interface *, unsigned int> interfaceIndex_;
+
+    void        packetIs(Ptr<Activity::Checkpoint> checkpoint, const Packet::Descriptor &packet);
+    Packet::Descriptor packet(Ptr<Activity::Checkpoint> checkpoint) const;
+    void        referenceIs(Ptr<Activity::Checkpoint> checkpoint, Node *node);
+    Node        *reference(Ptr<Activity::Checkpoint> checkpoint) const;
 };
 
 } /* end namespace */
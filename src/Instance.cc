@@ -22,6 +22,7 @@
  */
 
 Ptr<Instance::Manager> NetworkFactory();
+Ptr<Instance::Manager> NetworkFactory(Ptr<Simulation> simulation);
 
 namespace NetworkImpl
 {
@@ -50,16 +51,19 @@ public:
     Ptr<Instance>   instance(const string &name) const;
     InstanceCount   instances(string type) const;
     string          name() const { return "ManagerImpl"; }
+    Ptr<Simulation> simulation() const { return simulation_; }
 
     // Mutator
     Ptr<Instance>   instanceNew(const string &name, const string &type);
     void            instanceDel(const string &name);
+    void            snapshotIs(const string &file);
+    void            restoreIs(const string &file);
 
     // Callback handler
     void onNetworkUpdate();
 
     // Constructor/Destructor
-    ManagerImpl();
+    ManagerImpl(Ptr<Simulation> simulation);
     ~ManagerImpl() { GLUE_TRACE("Destroyed\n"); }
 
 private:
@@ -69,6 +73,7 @@ private:
     static const string CONFIG_NAME;
     static const string CONN_NAME;
 
+    Ptr<Simulation> simulation_;
     map<string,Ptr<Instance> > instance_;
     map<string,InstanceCount > instanceCount_; // count number of instance
     Ptr<Instance> config_;
@@ -77,6 +82,7 @@ private:
     void instancesInc(string name);
     void instancesDec(string name);
     bool badName(const string &name); // reject invalid instance naming
+    string type(Ptr<Instance> instance) const;
 };
 const string ManagerImpl::CONFIG_NAME   = "config";
 const string ManagerImpl::CONN_NAME     = "conn";
@@ -149,6 +155,10 @@ public:
 
 private:
     ManagerImpl* manager_;
+
+    Ptr<Activity::Manager> realTime() const { 
+        return manager_->simulation()->realTimeActivityManager(); 
+    }
 };
 
                                                                                                   
@@ -157,7 +167,7 @@ public:
     ATMSwitchGlue(const string &name, ManagerImpl *manager) 
     :NodeGlue(name, manager) { 
         Ptr<Node> node;
-        node = new ATMSwitch(name); 
+        node = new ATMSwitch(name, manager->simulation()); 
         if (!node) throw ResourceException();
         nodeIs(node);
     }
@@ -168,7 +178,7 @@ public:
     EthernetSwitchGlue(const string &name, ManagerImpl *manager) 
     :NodeGlue(name, manager) { 
         Ptr<Node> node;
-        node = new EthernetSwitch(name); 
+        node = new EthernetSwitch(name, manager->simulation()); 
         if (!node) throw ResourceException();
         nodeIs(node);
     }
@@ -179,7 +189,7 @@ public:
     IPRouterGlue(const string &name, ManagerImpl *manager) 
     :NodeGlue(name, manager) { 
         Ptr<Node> node;
-        node = new IPRouter(name); 
+        node = new IPRouter(name, manager->simulation()); 
         if (!node) throw ResourceException();
         nodeIs(node);
     }
@@ -191,7 +201,7 @@ public:
     IPHostGlue(const string &name, ManagerImpl *manager) 
     :NodeGlue(name, manager) { 
         Ptr<Node> node;
-        node = new IPHost(name); 
+        node = new IPHost(name, manager->simulation()); 
         if (!node) throw ResourceException();
         nodeIs(node);
     }
@@ -204,7 +214,7 @@ public:
     ATMInterfaceGlue(const string &name, ManagerImpl *manager) 
     :InterfaceGlue(name, manager) { 
         Ptr<Interface> intf;
-        intf = new ATMInterface(name); 
+        intf = new ATMInterface(name, manager->simulation()); 
         if (!intf) throw ResourceException();
         interfaceIs(intf);
     }
@@ -215,7 +225,7 @@ public:
     EthernetInterfaceGlue(const string &name, ManagerImpl *manager) 
     :InterfaceGlue(name, manager) { 
         Ptr<Interface> intf;
-        intf = new EthernetInterface(name);
+        intf = new EthernetInterface(name, manager->simulation());
         if (!intf) throw ResourceException();
         interfaceIs(intf);
     }
@@ -231,7 +241,8 @@ public:
  * no memory during instance accessor
  */
 
-ManagerImpl::ManagerImpl()
+ManagerImpl::ManagerImpl(Ptr<Simulation> simulation)
+    :simulation_(simulation)
 {
     conn_ = new ConnectionGlue("conn", this);
     if (!conn_) throw ResourceException();
@@ -397,7 +408,8 @@ ManagerImpl::instance(const string &name) const
  * instanceDel:
  *
  * dissosiate all reference to other object
- * set the gore object to NULL in the glue object
+ * set the gore object to NULL in the glue object, the gore object
+ * goes away with its last reference
  * decrement instance count
  * erase it from the map hastable
  */
@@ -418,14 +430,23 @@ ManagerImpl::instanceDel(const string &name)
     Ptr<InterfaceGlue> intfGlue = dynamic_cast<InterfaceGlue *>(instance.value());
     if (intfGlue) {
         Ptr<Interface> intf = intfGlue->interface();
-        intf->~Interface();
+        Ptr<Node> node = intf->node();
+
+        /*
+         * the node it is plugged into holds it too
+         */
+        for (unsigned int i = 0; node && node->interface(i); i++) {
+            if (node->interface(i) == intf) {
+                node->interfaceIs(i, NULL);
+                break;
+            }
+        }
+        intf->otherSideIs(NULL);
         intfGlue->interfaceIs(NULL);
     }
 
     Ptr<NodeGlue> nodeGlue = dynamic_cast<NodeGlue *>(instance.value());
     if (nodeGlue) {
-        Ptr<Node>  node = nodeGlue->node();
-        node->~Node();
         nodeGlue->nodeIs(NULL);
     }
 
@@ -434,6 +455,112 @@ ManagerImpl::instanceDel(const string &name)
     onNetworkUpdate();
 }
 
+/**
+ * type:
+ *
+ * the type an instance was made with, empty for config and conn
+ */
+
+string
+ManagerImpl::type(Ptr<Instance> instance) const
+{
+    Ptr<NodeGlue> nodeGlue = dynamic_cast<NodeGlue *>(instance.value());
+    if (nodeGlue) {
+        Node *node = nodeGlue->node().value();
+
+        if (dynamic_cast<ATMSwitch *>(node))      return "ATM switch";
+        if (dynamic_cast<EthernetSwitch *>(node)) return "Ethernet switch";
+        if (dynamic_cast<IPRouter *>(node))       return "IP router";
+        if (dynamic_cast<IPHost *>(node))         return "IP host";
+    }
+
+    Ptr<InterfaceGlue> intfGlue = dynamic_cast<InterfaceGlue *>(instance.value());
+    if (intfGlue) {
+        Interface *intf = intfGlue->interface().value();
+
+        if (dynamic_cast<ATMInterface *>(intf))      return "ATM interface";
+        if (dynamic_cast<EthernetInterface *>(intf)) return "Ethernet interface";
+    }
+    return "";
+}
+
+/**
+ * snapshotIs:
+ *
+ * checkpoint the whole network and its virtual time manager to
+ * file: the instances by name and type, then their state
+ */
+
+void
+ManagerImpl::snapshotIs(const string &file)
+{
+    Ptr<Activity::Checkpoint> checkpoint = 
+        new Activity::Checkpoint(file, Activity::Checkpoint::Save);
+    vector<Ptr<Instance> > instance;
+    Snapshot snapshot(simulation_);
+
+    map<string, Ptr<Instance> >::iterator i;
+    for (i = instance_.begin(); i != instance_.end(); i++) {
+        if (!type((*i).second).empty()) {
+            instance.push_back((*i).second);
+        }
+    }
+
+    checkpoint->integerIs(instance.size());
+    for (unsigned int j = 0; j < instance.size(); j++) {
+        checkpoint->textIs(instance[j]->name());
+        checkpoint->textIs(type(instance[j]));
+
+        Ptr<NodeGlue> nodeGlue = dynamic_cast<NodeGlue *>(instance[j].value());
+        if (nodeGlue) {
+            snapshot.nodeIs(nodeGlue->node());
+        } else {
+            snapshot.interfaceIs(dynamic_cast<InterfaceGlue *>(instance[j].value())->interface());
+        }
+    }
+    snapshot.snapshotIs(checkpoint);
+    checkpoint->close();
+}
+
+/**
+ * restoreIs:
+ *
+ * rebuild the network checkpointed to file.  Nothing but config and
+ * conn may exist yet, routes come from the file and are not computed.
+ */
+
+void
+ManagerImpl::restoreIs(const string &file)
+{
+    Ptr<Activity::Checkpoint> checkpoint = 
+        new Activity::Checkpoint(file, Activity::Checkpoint::Load);
+    Snapshot snapshot(simulation_);
+
+    map<string, Ptr<Instance> >::iterator i;
+    for (i = instance_.begin(); i != instance_.end(); i++) {
+        if (!type((*i).second).empty()) {
+            GLUE_ERR("'%s' exists, restore needs an empty network\n", 
+                     (*i).first.c_str());
+            throw PermissionException("restore needs an empty network");
+        }
+    }
+
+    unsigned long long instances = checkpoint->integer();
+    for (unsigned long long j = 0; j < instances; j++) {
+        string name = checkpoint->text();
+        Ptr<Instance> instance = instanceNew(name, checkpoint->text());
+
+        Ptr<NodeGlue> nodeGlue = dynamic_cast<NodeGlue *>(instance.value());
+        if (nodeGlue) {
+            snapshot.nodeIs(nodeGlue->node());
+        } else {
+            snapshot.interfaceIs(dynamic_cast<InterfaceGlue *>(instance.value())->interface());
+        }
+    }
+    snapshot.restoreIs(checkpoint);
+    checkpoint->close();
+}
+
 /**
  * instances:
  *
@@ -524,6 +651,12 @@ ManagerImpl::badName(const string &name)
 string
 NodeGlue::attribute(const string &attributeName) const
 {
+    if (attributeName == "partition") {
+        char buf[100];
+        snprintf(buf, sizeof(buf), "%u", node()->partition());
+        return buf;
+    }
+
     if (attributeName.substr(0, 9) != "interface") {
         GLUE_ERR("invalid node attribute '%s'\n", attributeName.c_str());
         return "";
@@ -554,6 +687,11 @@ NodeGlue::attributeIs(const string &attributeName,
     GLUE_TRACE("%s->%s: %s\n", 
                name().c_str(), attributeName.c_str(), newValueString.c_str());
 
+    if (attributeName == "partition") {
+        node()->partitionIs(atoi(newValueString.c_str()));
+        return;
+    }
+
     if (attributeName.substr(0, 9) != "interface") {
         GLUE_ERR("invalid node attribute '%s'\n", attributeName.c_str());
         throw ParserException();
@@ -633,6 +771,13 @@ InterfaceGlue::attribute(const string &attributeName) const
         return buf;
     }
 
+    if (attributeName == "propagation delay") {
+        char buf[100];
+        snprintf(buf, sizeof(buf), "%lld", 
+                 (long long)interface()->propagationDelay().value());
+        return buf;
+    }
+
     GLUE_ERR("invalid interface attribute '%s'\n" ,attributeName.c_str());
     return "";
 }
@@ -650,6 +795,15 @@ InterfaceGlue::attributeIs(const string &attributeName,
     }
 
     if (attributeName == "other side") {
+        /*
+         * an empty other side fails the link
+         */
+        if (newValueString.empty()) {
+            interface()->otherSideIs(NULL);
+            manager_->onNetworkUpdate();
+            return;
+        }
+
         Ptr<Instance> otherSide = manager_->instance(newValueString);
         if (!otherSide) {
             GLUE_ERR("other side %s not found\n", newValueString.c_str());
@@ -688,6 +842,14 @@ InterfaceGlue::attributeIs(const string &attributeName,
         return;
     }
 
+    /*
+     * in nanosecond
+     */
+    if (attributeName == "propagation delay") {
+        interface()->propagationDelayIs(Time((int64_t)atoll(newValueString.c_str())));
+        return;
+    }
+
     GLUE_ERR("invalid or not-writable attribute %s\n", attributeName.c_str());
     throw ParserException();
 }
@@ -768,6 +930,57 @@ ConfigGlue::attribute(const string &attributeName) const
 {
     char buf[100];
 
+    /*
+     * real time lag statistics, in nanosecond
+     */
+    if (attributeName == "lag max") {
+        snprintf(buf, sizeof(buf), "%lld", 
+                 (long long)realTime()->lagMax().value());
+        return buf;
+    }
+
+    if (attributeName == "lag threshold") {
+        snprintf(buf, sizeof(buf), "%lld", 
+                 (long long)realTime()->lagThreshold().value());
+        return buf;
+    }
+
+    if (attributeName == "lag misses") {
+        snprintf(buf, sizeof(buf), "%llu", realTime()->lagMisses());
+        return buf;
+    }
+
+    if (attributeName == "ratio") {
+        snprintf(buf, sizeof(buf), "%u", realTime()->dilation());
+        return buf;
+    }
+
+    if (attributeName == "adaptive ratio") {
+        return realTime()->adaptive() ? "true" : "false";
+    }
+
+    if (attributeName == "batch histogram") {
+        string histogram;
+
+        for (unsigned int i = 0; i < Activity::Manager::BatchBuckets; i++) {
+            snprintf(buf, sizeof(buf), i ? " %llu" : "%llu", 
+                     manager_->simulation()->activityManager()->batchHistogram(i));
+            histogram += buf;
+        }
+        return histogram;
+    }
+
+    if (attributeName == "lag histogram") {
+        string histogram;
+
+        for (unsigned int i = 0; i < Activity::Manager::LagBuckets; i++) {
+            snprintf(buf, sizeof(buf), i ? " %llu" : "%llu", 
+                     realTime()->lagHistogram(i));
+            histogram += buf;
+        }
+        return histogram;
+    }
+
     ManagerImpl::InstanceCount total = manager_->instances(attributeName);
     snprintf(buf, sizeof(buf), "%d", total.value());
     return string(buf);
@@ -777,6 +990,27 @@ void
 ConfigGlue::attributeIs(const string &attributeName, 
                         const string &newValueString)
 {
+    if (attributeName == "lag threshold") {
+        realTime()->lagThresholdIs(
+            Time((int64_t)atoll(newValueString.c_str())));
+        return;
+    }
+    if (attributeName == "adaptive ratio") {
+        realTime()->adaptiveIs(newValueString == "true");
+        return;
+    }
+
+    /*
+     * checkpoint file of the whole simulation
+     */
+    if (attributeName == "snapshot") {
+        manager_->snapshotIs(newValueString);
+        return;
+    }
+    if (attributeName == "restore") {
+        manager_->restoreIs(newValueString);
+        return;
+    }
     GLUE_ERR("trying to write to a read only instance\n");
 }
 
@@ -873,12 +1107,21 @@ IPHostGlue::attributeIs (const string &attributeName,
  * in turn interact with the gore layer).
  */
 Ptr<Instance::Manager>
-NetworkFactory()
+NetworkFactory(Ptr<Simulation> simulation)
 {
     Ptr<Instance::Manager> m;
-    m = new NetworkImpl::ManagerImpl();
+    m = new NetworkImpl::ManagerImpl(simulation);
     if (!m) throw ResourceException();
     return m;
 }
 
+/*
+ * a network of the default simulation, on ActivityManager()
+ */
+Ptr<Instance::Manager>
+NetworkFactory()
+{
+    return NetworkFactory(SimulationDefault());
+}
+
 /* end-of-file */
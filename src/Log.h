@@ -25,6 +25,7 @@ public:
     // Types
     enum Priority {
         Error,
+        Info,   // always shown, like Error
         Debug
     };
     static const bool DebugDefault = DEBUG_DEFAULT;
@@ -14,6 +14,7 @@
 
 #include "PtrInterface.h"
 #include "Ptr.h"
+#include "WeakPtr.h"
 
 using namespace std;
 
@@ -36,7 +37,7 @@ public:
     typename Notifier::Ptr notifier() const { return notifier_; }
 
     void notifierIs(typename Notifier::Ptr n) {
-        if(notifier_ == n) return;
+        if(notifier_.value() == n.value()) return;
         if(notifier_) notifier_->notifieeIs(0);
         notifier_ = n;
         if(n) n->notifieeIs(static_cast<typename Notifier::Notifiee *>(this));
@@ -47,7 +48,8 @@ public:
     }
 
 private:
-    typename Notifier::Ptr notifier_;
+    /* weak, a notifier usually owns its notifiee */
+    WeakPtr<Notifier> notifier_;
 };
 
 #include "Ptr.in"
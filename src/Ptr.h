@@ -11,12 +11,21 @@ class Ptr {
     ~Ptr();
     void operator=( const Ptr<T>& mp );
     void operator=( Ptr<T>& mp );
+#if __cplusplus >= 201103L
+    Ptr( Ptr<T>&& mp ) : value_(mp.value_) { mp.value_ = 0; }
+    void operator=( Ptr<T>&& mp );
+#endif
     bool operator==( const Ptr<T>& mp ) const { return mp.value_ == value_; }
     const T * operator->() const { return value_; }
     T * operator->() { return (T *) value_; }
     T * value() const { return (T *) value_; }
     operator bool() const { return value_ ? 1 : 0; }
 
+    // hand the reference over to the caller, the Ptr is left null
+    T * release() { T * ptr = value_; value_ = 0; return ptr; }
+    // take over a reference counted already, e.g. one from release()
+    void adopt( T *ptr );
+
     template <class OtherType>
     operator Ptr<OtherType>() const {
         return Ptr<OtherType>( value_ ); }
@@ -5,6 +5,137 @@
 
 typedef long RefCount;
 
+/**
+ * NonAtomicRefCount and AtomicRefCount are the reference counting
+ * policies of PtrInterface and PtrInterfaceFrom.
+ * <p>
+ * - NonAtomicRefCount, the default, is for objects used by one thread.
+ * - AtomicRefCount lets Ptrs to the object be copied and dropped in
+ *   several threads at once.  Taking a reference is relaxed, the new
+ *   owner got the object from someone who holds one already; dropping
+ *   one is acquire/release, so whoever deletes the object sees every
+ *   write made before the other references were dropped.
+ * <p>
+ * atomic tells them apart, a WeakPtr cannot refer to an object counted
+ * atomically, see WeakReference.
+ */
+class NonAtomicRefCount {
+  public:
+    static const bool atomic = false;
+    static RefCount value( const RefCount *count ) { return *count; }
+    static void increment( RefCount *count ) { ++*count; }
+    static RefCount decrement( RefCount *count ) { return --*count; }
+};
+
+class AtomicRefCount {
+  public:
+    static const bool atomic = true;
+#ifdef __ATOMIC_RELAXED
+    static RefCount value( const RefCount *count ) {
+        return __atomic_load_n( count, __ATOMIC_RELAXED ); }
+    static void increment( RefCount *count ) {
+        __atomic_fetch_add( count, 1, __ATOMIC_RELAXED ); }
+    static RefCount decrement( RefCount *count ) {
+        return __atomic_sub_fetch( count, 1, __ATOMIC_ACQ_REL ); }
+#else
+    /* older compilers only have full barriers */
+    static RefCount value( const RefCount *count ) {
+        return __sync_fetch_and_add( (RefCount *) count, 0 ); }
+    static void increment( RefCount *count ) {
+        __sync_fetch_and_add( count, 1 ); }
+    static RefCount decrement( RefCount *count ) {
+        return __sync_sub_and_fetch( count, 1 ); }
+#endif
+};
+
+/**
+ * WeakReference is what the WeakPtrs to an object share.  The object
+ * holds one reference to it and every WeakPtr another; the object lets
+ * go of its own, leaving it expired, when its last Ptr is dropped or
+ * it is destroyed.  Made the first time a WeakPtr asks for it.
+ * <p>
+ * Neither its count nor its making is synchronized, and a WeakPtr
+ * hands out a plain pointer that another thread could be deleting.
+ * Objects under AtomicRefCount are shared across threads, asking one
+ * for a WeakReference does not compile, see WeakReferenceNeedsOneThread.
+ */
+class WeakReference {
+  public:
+    WeakReference(): references_(1), expired_(false) {}
+
+    bool expired() const { return expired_; }
+    void newRef() { ++references_; }
+    void deleteRef() { if ( --references_ == 0 ) delete this; }
+    void expiredIs() { expired_ = true; deleteRef(); }
+
+  private:
+    RefCount references_;
+    bool expired_;
+};
+
+template <bool> struct WeakReferenceNeedsOneThread;
+template <> struct WeakReferenceNeedsOneThread<true> {};
+
+/**
+ * PtrReferenceCount is the reference count of a PtrInterface or
+ * PtrInterfaceFrom, kept here once for both.  It counts with Policy
+ * and expires the object's WeakReference along with the last
+ * reference.  Owner is the class holding it, the PTR_COUNT counters
+ * are per Owner.
+ */
+template <class Owner, class Policy>
+class PtrReferenceCount {
+  public:
+    PtrReferenceCount(): references_(0), weak_(0) {}
+    ~PtrReferenceCount() { expire(); }
+
+    RefCount value() const { return Policy::value( &references_ ); }
+
+    void newRef() {
+	Policy::increment( &references_ );
+#ifdef PTR_COUNT
+	++refOps_;
+#endif
+    }
+
+    // true when the last reference is gone
+    bool deleteRef() {
+#ifdef PTR_COUNT
+        ++refOps_;
+#endif
+        if ( Policy::decrement( &references_ ) != 0 ) return false;
+        expire();
+        return true;
+    }
+
+    WeakReference * newWeakRef() {
+        (void) sizeof( WeakReferenceNeedsOneThread<!Policy::atomic> );
+        if ( !weak_ ) weak_ = new WeakReference();
+        weak_->newRef();
+        return weak_;
+    }
+
+#ifdef PTR_COUNT
+    // newRef and deleteRef calls on any Owner, not thread safe
+    static unsigned long refOps() { return refOps_; }
+    static void refOpsIs(unsigned long n) { refOps_ = n; }
+#endif
+
+  private:
+    void expire() { if ( weak_ ) { weak_->expiredIs(); weak_ = 0; } }
+
+    RefCount references_;
+    WeakReference *weak_;
+#ifdef PTR_COUNT
+    static unsigned long refOps_;
+#endif
+  };
+
+#ifdef PTR_COUNT
+template <class Owner, class Policy>
+unsigned long PtrReferenceCount<Owner, Policy>::refOps_ = 0;
+#endif
+
 /**
  * PtrInterface defines a template interface for top-level reference-managed
  * classes.  The template parameter T is the class itself.
@@ -14,35 +145,45 @@ typedef long RefCount;
  * <p>
  * - Use PtrInterface for top-level interfaces.
  * - Use PtrInterfaceFrom for derived interfaces.
+ * <p>
+ * The optional Policy parameter picks how references are counted,
+ * see AtomicRefCount.  newWeakRef backs WeakPtr, see WeakReference.
  *
  * @author David Cheriton, modified by Ed Swierk
  * @version Stanford CS 249 Winter 2002 version 1.0
  */
-template <class T>
+template <class T, class Policy = NonAtomicRefCount>
 class PtrInterface {
   public:
-    PtrInterface(): references_(0) {}
+    typedef PtrReferenceCount<PtrInterface<T, Policy>, Policy> ReferenceCount;
 
-    RefCount references() const { return references_; }
+    RefCount references() const { return count_.value(); }
 
-    const PtrInterface<T> * newRef() const {
-        PtrInterface<T> * me = (PtrInterface<T> *) this;
-	++me->references_;
-	return this;
+    const PtrInterface<T, Policy> * newRef() const {
+        count_.newRef();
+        return this;
     }
 
     void deleteRef() const {
-        PtrInterface<T> * me = (PtrInterface<T> *) this;
-        if ( --me->references_ == 0 ) me->onZeroReferences();
+        if ( count_.deleteRef() ) {
+            ((PtrInterface<T, Policy> *) this)->onZeroReferences();
+        }
     }
 
+    WeakReference * newWeakRef() const { return count_.newWeakRef(); }
+
+#ifdef PTR_COUNT
+    static unsigned long refOps() { return ReferenceCount::refOps(); }
+    static void refOpsIs(unsigned long n) { ReferenceCount::refOpsIs( n ); }
+#endif
+
   protected:
     virtual ~PtrInterface() {}
 
   private:
     virtual void onZeroReferences() { delete this; }
 
-    RefCount references_;
+    mutable ReferenceCount count_;
   };
 
 
@@ -50,31 +191,38 @@ class PtrInterface {
  * PtrInterfaceFrom defines a template interface for derived
  * reference-managed classes.  The template parameter T is the base class.
  */
-template <class T>
+template <class T, class Policy = NonAtomicRefCount>
 class PtrInterfaceFrom : public T {
   public:
-    PtrInterfaceFrom(): references_(0) {}
+    typedef PtrReferenceCount<PtrInterfaceFrom<T, Policy>, Policy> ReferenceCount;
 
-    RefCount references() const { return references_; }
+    RefCount references() const { return count_.value(); }
 
-    const PtrInterfaceFrom<T> * newRef() const {
-        PtrInterfaceFrom<T> * me = (PtrInterfaceFrom<T> *) this;
-	++me->references_;
-	return this;
+    const PtrInterfaceFrom<T, Policy> * newRef() const {
+        count_.newRef();
+        return this;
     }
 
     void deleteRef() const {
-        PtrInterfaceFrom<T> * me = (PtrInterfaceFrom<T> *) this;
-        if ( --me->references_ == 0 ) me->onZeroReferences();
+        if ( count_.deleteRef() ) {
+            ((PtrInterfaceFrom<T, Policy> *) this)->onZeroReferences();
+        }
     }
 
+    WeakReference * newWeakRef() const { return count_.newWeakRef(); }
+
+#ifdef PTR_COUNT
+    static unsigned long refOps() { return ReferenceCount::refOps(); }
+    static void refOpsIs(unsigned long n) { ReferenceCount::refOpsIs( n ); }
+#endif
+
   protected:
     virtual ~PtrInterfaceFrom() {}
 
   private:
     virtual void onZeroReferences() { delete this; }
 
-    RefCount references_;
+    mutable ReferenceCount count_;
   };
 
 #endif
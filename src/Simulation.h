@@ -0,0 +1,84 @@
+/*
+ * $Id: Simulation.h,v 1.1 2005/12/05 02:07:19 fzb Exp $
+ *
+ * Simulation.h -- context of one simulation
+ *
+ * Fritz Budiyanto, December 2005
+ *
+ */
+
+#ifndef __SIMULATION_H__
+#define __SIMULATION_H__
+
+#include <string>
+#include <vector>
+
+#include "PtrInterface.h"
+#include "Ptr.h"
+#include "Activity.h"
+
+using namespace std;
+
+namespace NetworkImpl { class Node; class Interface; }
+
+/**
+ * Simulation:
+ *
+ * everything one simulation shares: the virtual time manager running
+ * it, the real time manager that drives it when it runs in real time
+ * (made the first time it is asked for), its interfaces by ordinal
+ * and its nodes by id.  Networks of different simulations have
+ * nothing in common, each may run in a thread of its own.  The
+ * simulation itself may be held from any thread, its references are
+ * atomic.  The interface and node tables change only while the
+ * network is built, partitions running it only look them up.
+ */
+class Simulation : public PtrInterface<Simulation, AtomicRefCount> {
+public:
+    // Types
+    typedef Ptr<Simulation> Ptr;
+
+    // Accessor
+    Ptr<Activity::Manager>  activityManager() const { return activityManager_; }
+    Ptr<Activity::Manager>  realTimeActivityManager();
+    unsigned int            interfaceOrdinals() const { return interface_.size(); }
+    NetworkImpl::Interface  *interface(unsigned int ordinal) const {
+        return ordinal < interface_.size() ? interface_[ordinal] : NULL;
+    }
+    NetworkImpl::Node       *node(unsigned int id) const {
+        return id < node_.size() ? node_[id] : NULL;
+    }
+
+    // Mutator
+    unsigned int            interfaceOrdinalNew(NetworkImpl::Interface *intf);
+    void                    interfaceOrdinalIs(unsigned int ordinal, NetworkImpl::Interface *intf);
+    void                    interfaceOrdinalDel(unsigned int ordinal);
+    unsigned int            nodeIdNew(NetworkImpl::Node *node);
+    void                    nodeIdDel(unsigned int id);
+
+    // Constructor/Destructor
+    Simulation(Ptr<Activity::Manager> am)
+        :activityManager_(am), node_(1, (NetworkImpl::Node *)NULL) {
+        if (!am) throw RangeException();
+    }
+
+private:
+    Ptr<Activity::Manager>  activityManager_;
+    Ptr<Activity::Manager>  realTimeActivityManager_;
+    vector<NetworkImpl::Interface *> interface_;    // by ordinal
+    vector<NetworkImpl::Node *> node_;          // by id, 0 is no node
+};
+
+/*
+ * a simulation on a new virtual time manager of the given type, see
+ * ActivityFactory.  SimulationDefault is the one on ActivityManager()
+ * and RealTimeActivityManager().
+ */
+Ptr<Simulation> SimulationFactory(const string &type);
+Ptr<Simulation> SimulationDefault();
+
+#include "Ptr.in"
+
+#endif /* __SIMULATION_H__ */
+
+/* end of file */
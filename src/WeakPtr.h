@@ -0,0 +1,81 @@
+// Copyright (C) 1993-2002 David R. Cheriton.  All rights reserved.
+
+#ifndef FWK_WEAKPTR_H
+#define FWK_WEAKPTR_H
+
+#include "Ptr.h"
+
+/**
+ * WeakPtr refers to a reference-managed object without keeping it
+ * alive: once the last Ptr to the object is gone it reads as null.
+ * Use it for back-edges that would otherwise close a reference cycle,
+ * e.g. from an interface to the node owning it.  The object's
+ * WeakReference is shared by all its WeakPtrs and counted apart from
+ * the object; it is not thread safe, and an object counted with
+ * AtomicRefCount cannot have WeakPtrs.
+ */
+template <class T>
+class WeakPtr {
+  public:
+    WeakPtr( T *ptr = 0 );
+    WeakPtr( const Ptr<T>& mp );
+    WeakPtr( const WeakPtr<T>& wp );
+    ~WeakPtr();
+    void operator=( const WeakPtr<T>& wp );
+    void operator=( const Ptr<T>& mp );
+    void operator=( T *ptr );
+    bool operator==( const WeakPtr<T>& wp ) const { return wp.value() == value(); }
+    const T * operator->() const { return value(); }
+    T * operator->() { return value(); }
+    T * value() const { return ( ref_ && !ref_->expired() ) ? value_ : 0; }
+    operator bool() const { return value() ? 1 : 0; }
+    operator Ptr<T>() const { return Ptr<T>( value() ); }
+
+  protected:
+    T *value_;
+    WeakReference *ref_;
+};
+
+template<class T>
+WeakPtr<T>::WeakPtr( T * ptr ) : value_(ptr), ref_(0) {
+    if( value_ ) ref_ = value_->newWeakRef();
+  }
+
+template<class T>
+WeakPtr<T>::WeakPtr( const Ptr<T>& mp ) : value_(mp.value()), ref_(0) {
+    if( value_ ) ref_ = value_->newWeakRef();
+  }
+
+template<class T>
+WeakPtr<T>::WeakPtr( const WeakPtr<T>& wp ) : value_(wp.value_), ref_(wp.ref_) {
+    if( ref_ ) ref_->newRef();
+  }
+
+template<class T>
+WeakPtr<T>::~WeakPtr() {
+    if( ref_ ) ref_->deleteRef();
+  }
+
+template<class T> void
+WeakPtr<T>::operator=( const WeakPtr<T>& wp ) {
+    WeakReference * save = ref_;
+    value_ = wp.value_;
+    ref_ = wp.ref_;
+    if( ref_ ) ref_->newRef();
+    if( save ) save->deleteRef();
+  }
+
+template<class T> void
+WeakPtr<T>::operator=( const Ptr<T>& mp ) {
+    operator=( mp.value() );
+  }
+
+template<class T> void
+WeakPtr<T>::operator=( T * ptr ) {
+    WeakReference * save = ref_;
+    value_ = ptr;
+    ref_ = ptr ? ptr->newWeakRef() : 0;
+    if( save ) save->deleteRef();
+  }
+
+#endif /* FWK_WEAKPTR_H */
@@ -0,0 +1,276 @@
+/*
+ * $Id: benchmark.cc,v 1.1 2005/12/05 02:07:20 fzb Exp $
+ *
+ * benchmark.cc -- Activity::Manager waiting queue benchmark
+ *
+ * Fritz Budiyanto, December 2005
+ *
+ */
+
+/*
+ * Hold model: n activities are pending at all times, each one
+ * reschedules itself a few microseconds ahead when it fires, the way
+ * InterfaceReactor::onQueue schedules serialization completions.
+ * The cost per event is reported for every manager type, once with
+ * activities and once with one-shot timers.
+ *
+ * With -f packets are forwarded instead: one host sends to another
+ * through a chain of switches and the cost per packet delivered is
+ * reported, with the Ptr<Packet> reference count operations it took
+ * when built with -DPTR_COUNT.
+ */
+
+#include <string>
+#include <iostream>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/time.h>
+
+#include "Exception.h"
+#include "Notifiee.h"
+#include "Activity.h"
+#include "Instance.h"
+#include "Simulation.h"
+#include "Gore.h"
+
+extern Ptr<Activity::Manager> ActivityFactory(const string &type);
+extern Ptr<Instance::Manager> NetworkFactory(Ptr<Simulation> simulation);
+
+class HoldReactor : public RootNotifiee
+{
+public:
+    static const long DelayMin  = 1000;     // in nanosecond
+    static const long DelayMax  = 100000;   // in nanosecond
+
+    unsigned long events() const { return events_; }
+
+    void handleNotification(Activity *a) {
+        events_++;
+        a->nextTimeIs(am_->now() + delay());
+        a->timeoutNotifieeIs(this);
+    }
+
+    Time delay() {
+        seed_ = seed_ * 1103515245 + 12345;
+        return Time((double)(DelayMin + (seed_ >> 8) % (DelayMax - DelayMin)));
+    }
+
+    HoldReactor(Ptr<Activity::Manager> am) :am_(am), events_(0), seed_(1) {}
+
+private:
+    friend class HoldTimer;
+
+    Ptr<Activity::Manager>  am_;
+    unsigned long           events_;
+    unsigned long           seed_;
+};
+
+/*
+ * the same hold model on Activity::Manager::timerNew, each timer
+ * schedules its successor
+ */
+class HoldTimer {
+public:
+    void operator()() {
+        reactor_->events_++;
+        am_->timerNew(am_->now() + reactor_->delay(), *this);
+    }
+
+    HoldTimer(Activity::Manager *am, HoldReactor *reactor)
+        :am_(am), reactor_(reactor) {}
+
+private:
+    Activity::Manager   *am_;
+    HoldReactor         *reactor_;
+};
+
+double
+elapsed(struct timeval &start)
+{
+    struct timeval current;
+
+    gettimeofday(&current, NULL);
+    return (current.tv_sec - start.tv_sec) +
+           (current.tv_usec - start.tv_usec) / 1000000.0;
+}
+
+bool lazyCancel = false;
+
+void
+hold(const string &type, bool timer, long pending, long events)
+{
+    Ptr<Activity::Manager>  am = ActivityFactory(type);
+    Ptr<HoldReactor>        reactor = new HoldReactor(am);
+    struct timeval          start;
+    char                    buf[100];
+
+    am->lazyCancelIs(lazyCancel);
+    am->runningIs(false);
+    am->nowIs(Time(0.0));
+    for (long i = 0; i < pending; i++) {
+        Activity::Ptr activity;
+
+        if (timer) {
+            am->timerNew(reactor->delay(), 
+                         HoldTimer(am.value(), reactor.value()));
+            continue;
+        }
+        sprintf(buf, "hold%ld", i);
+        activity = am->activityNew(buf);
+        activity->nextTimeIs(reactor->delay());
+        activity->timeoutNotifieeIs(reactor);
+    }
+
+    /*
+     * on average every activity fires once per mean delay
+     */
+    double meanDelay = (HoldReactor::DelayMin + HoldReactor::DelayMax) / 2.0;
+    Time   duration((double)events * meanDelay / pending);
+
+    gettimeofday(&start, NULL);
+    am->runningIs(true);
+    am->nowIs(duration);
+    double seconds = elapsed(start);
+
+    printf("%-14s %-8s %10ld %10lu %10.1f\n", type.c_str(), 
+           timer ? "timer" : "activity", pending,
+           reactor->events(), seconds * 1000000000.0 / reactor->events());
+
+    for (long i = 0; i < pending && !timer; i++) {
+        sprintf(buf, "hold%ld", i);
+        am->activityDel(buf);
+    }
+}
+
+/**
+ * forward:
+ *
+ * host_src, switches switch0.. in a line and host_dst, the links
+ * fast enough for no queue to drop.  A propagation delay puts the
+ * packets on the wire between hops instead of handing them over.
+ */
+void
+forward(int switches, const string &delay, long packets)
+{
+    Ptr<Simulation>         simulation = SimulationFactory("heap");
+    Ptr<Instance::Manager>  manager = NetworkFactory(simulation);
+    Ptr<Activity::Manager>  am = simulation->activityManager();
+    Ptr<Instance>           node, intf;
+    string                  last;
+    struct timeval          start;
+    char                    buf[100];
+
+    am->runningIs(false);
+    am->nowIs(Time(0.0));
+    for (int i = -1; i <= switches; i++) {
+        if (i < 0) {
+            node = manager->instanceNew("host_src", "IP host");
+        } else if (i == switches) {
+            node = manager->instanceNew("host_dst", "IP host");
+        } else {
+            sprintf(buf, "switch%d", i);
+            node = manager->instanceNew(buf, "Ethernet switch");
+        }
+        for (int j = 0; j < (i < 0 || i == switches ? 1 : 2); j++) {
+            sprintf(buf, "%s_eth%d", node->name().c_str(), j);
+            intf = manager->instanceNew(buf, "Ethernet interface");
+            intf->attributeIs("data rate", "1000");
+            intf->attributeIs("propagation delay", delay);
+            sprintf(buf, "interface%d", j);
+            node->attributeIs(buf, intf->name());
+            if (j == 0 && !last.empty()) {
+                intf->attributeIs("other side", last);
+            }
+            last = intf->name();
+        }
+    }
+    manager->instance("host_src")->attributeIs("Transmit Rate", "100");
+    manager->instance("host_src")->attributeIs("Packet Size", "1000");
+    manager->instance("host_src")->attributeIs("Destination", "host_dst");
+
+    /*
+     * 1000 byte packets at 100 mbps, one every 80 usec
+     */
+    Time duration((double)packets * 80000.0);
+    Ptr<Instance> host_dst = manager->instance("host_dst");
+
+#ifdef PTR_COUNT
+    NetworkImpl::Packet::refOpsIs(0);
+#endif
+    gettimeofday(&start, NULL);
+    am->runningIs(true);
+    am->nowIs(duration);
+    double seconds = elapsed(start);
+    long received = atol(host_dst->attribute("Packets Received").c_str());
+
+    if (received <= 0) {
+        cout << "no packet arrived" << endl;
+        return;
+    }
+#ifdef PTR_COUNT
+    sprintf(buf, "%10.1f", (double)NetworkImpl::Packet::refOps() / received);
+#else
+    sprintf(buf, "%10s", "-");
+#endif
+    printf("%8d %8s %10ld %10.1f %s\n", switches, delay.c_str(), received,
+           seconds * 1000000000.0 / received, buf);
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char  *type[] = { "heap", "timing wheel" };
+    long        pending[] = { 10000, 100000, 1000000 };
+    long        events = 2000000;
+    int         c;
+    bool        forwarding = false;
+
+    while ((c = getopt(argc, argv, "he:lf")) > 0) {
+        switch (c) {
+        case 'h':
+            cout << "h  help" << endl;
+            cout << "e  events per run" << endl;
+            cout << "l  cancel rescheduled activities lazily" << endl;
+            cout << "f  forward packets, refcount operations need -DPTR_COUNT" << endl;
+            exit(0);
+            break;
+
+        case 'e':
+            events = atol(optarg);
+            break;
+
+        case 'l':
+            lazyCancel = true;
+            break;
+
+        case 'f':
+            forwarding = true;
+            break;
+        }
+    }
+
+    if (forwarding) {
+        const char  *delay[] = { "0", "1000" };
+        int         switches[] = { 1, 4, 16 };
+
+        printf("%8s %8s %10s %10s %10s\n", 
+               "switches", "delay", "packets", "ns/packet", "refs/packet");
+        for (unsigned int s = 0; s < sizeof(switches) / sizeof(switches[0]); s++) {
+            for (unsigned int d = 0; d < sizeof(delay) / sizeof(delay[0]); d++) {
+                forward(switches[s], delay[d], events / 10);
+            }
+        }
+        return 0;
+    }
+
+    printf("%-14s %-8s %10s %10s %10s\n", 
+           "manager", "mode", "pending", "events", "ns/event");
+    for (unsigned int p = 0; p < sizeof(pending) / sizeof(pending[0]); p++) {
+        for (unsigned int t = 0; t < sizeof(type) / sizeof(type[0]); t++) {
+            hold(type[t], false, pending[p], events);
+            hold(type[t], true, pending[p], events);
+        }
+    }
+}
+
+/* end of file */
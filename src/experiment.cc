@@ -10,12 +10,15 @@
 
 #include <string>
 #include <iostream>
+#include <algorithm>
 #include <stdlib.h>
 
 #include "Exception.h"
 #include "Instance.h"
 #include "Notifiee.h"
 #include "Activity.h"
+#include "Branch.h"
+#include "Simulation.h"
 #include "Log.h"
 
 Log logApp("GLUE");
@@ -26,9 +29,7 @@ logGlue.entryNew(Log::Error, "", __FUNCTION__, format, ##args)
 logGlue.entryNew(Log::Debug, "", __FUNCTION__, format, ##args)
 
 
-extern Ptr<Instance::Manager> NetworkFactory();
-extern Ptr<Activity::Manager> RealTimeActivityManager();
-extern Ptr<Activity::Manager> ActivityManager();
+extern Ptr<Instance::Manager> NetworkFactory(Ptr<Simulation> simulation);
 
 class Parameter {
 public:
@@ -47,30 +48,81 @@ public:
     static const int    SimulationTime      = 10; // in seconds
 
     string      packetSize() const;
-    string      transmitRate() const { return stringify(transmitRate_); }
-    string      dataRate() const { return stringify(dataRate_); }
+    string      transmitRate() const { return stringify(transmitRate_[0]); }
+    string      dataRate() const { return stringify(dataRate_[0]); }
     Time        simulationTime() const { return simulationTime_; }
-    int         switchTotal() const { return switchTotal_; }
-    int         switchPort() const { return switchPort_; }
+    int         switchTotal() const { return switchTotal_[0]; }
+    int         switchPort() const { return switchPort_[0]; }
+    unsigned int seed() const { return seed_[0]; }
     RunningMode runningMode() const { return runningMode_; }
+    string      managerType() const { return managerType_; }
+    bool        lazyCancel() const { return lazyCancel_; }
+    int         partitions() const { return partitions_; }
+    string      propagationDelay() const { return stringify(propagationDelay_); }
+    Time        lookahead() const { return Time((int64_t)propagationDelay_); }
+    Time        optimism() const { return Time((int64_t)optimism_); }
+    bool        adaptive() const { return adaptive_; }
+    bool        batches() const { return batches_; }
+    bool        profile() const { return profile_; }
+    string      trace() const { return trace_; }
+    string      replay() const { return replay_; }
+    string      snapshot() const { return snapshot_; }
+    string      restore() const { return restore_; }
+    vector<string> branches() const { return branches_; }
+    string      branchInterface() const { return branchInterface_; }
+    bool        sweep() const { return !format_.empty(); }
+    string      format() const { return format_; }
+    int         workers() const { return workers_; }
+    bool        quiet() const { return quiet_; }
+    bool        random() const { return random_; }
+    unsigned int configurations() const;
+    Parameter   configuration(unsigned int index) const;
 
     Parameter(int argc, char **argv);
 
 private:
     bool    random_;
-    int     packetSize_;
-    int     switchTotal_;
-    int     switchPort_;
-    int     dataRate_;
-    int     transmitRate_;
+    vector<int> packetSize_;
+    vector<int> switchTotal_;
+    vector<int> switchPort_;
+    vector<int> dataRate_;
+    vector<int> transmitRate_;
+    vector<int> seed_;
     Time    simulationTime_;
     RunningMode runningMode_;
+    string  managerType_;
+    bool    lazyCancel_;
+    int     partitions_;
+    int     propagationDelay_;
+    int     optimism_;
+    bool    adaptive_;
+    bool    batches_;
+    bool    profile_;
+    string  trace_;
+    string  replay_;
+    string  snapshot_;
+    string  restore_;
+    vector<string> branches_;
+    string  branchInterface_;
+    string  format_;
+    int     workers_;
+    bool    quiet_;
 
-    bool    random() const { return random_; }
     string  randomPacketSize() const;
     string  stringify(int i) const;
+    vector<int> list(const char *arg) const;
 };
 
+/*
+ * the defaults are bound by reference when the lists are made
+ */
+const int Parameter::SwitchTotal;
+const int Parameter::SwitchPort;
+const int Parameter::TransmitRate;
+const int Parameter::PacketSize;
+const int Parameter::DataRate;
+const int Parameter::SimulationTime;
+
 string  
 Parameter::stringify(int i) const
 {
@@ -93,19 +145,93 @@ Parameter::randomPacketSize() const
 string
 Parameter::packetSize() const {
     if (!random()) {
-        return stringify(PacketSize);
+        return stringify(packetSize_[0]);
     }
     return randomPacketSize();
 }
 
+/**
+ * list:
+ *
+ * parse a comma separated list of values and ranges, a range is
+ * low:high or low:high:step, e.g. "10,20,40:100:20"
+ */
+vector<int>
+Parameter::list(const char *arg) const
+{
+    vector<int> value;
+    string s(arg);
+    string::size_type begin = 0;
+
+    while (begin <= s.size()) {
+        string::size_type end = s.find(',', begin);
+        if (end == string::npos) {
+            end = s.size();
+        }
+        string item = s.substr(begin, end - begin);
+        int colons = count(item.begin(), item.end(), ':');
+        int low, high, step = 1;
+        int n = sscanf(item.c_str(), "%d:%d:%d", &low, &high, &step);
+
+        if (n < 1 || n != colons + 1 || step <= 0 || (n > 1 && high < low)) {
+            cout << "bad value or range: " << item << endl;
+            exit(1);
+        }
+        if (n == 1) {
+            high = low;
+        }
+        for (int v = low; v <= high; v += step) {
+            value.push_back(v);
+        }
+        begin = end + 1;
+    }
+    return value;
+}
+
+unsigned int
+Parameter::configurations() const
+{
+    return switchTotal_.size() * switchPort_.size() * packetSize_.size() *
+           transmitRate_.size() * dataRate_.size() * seed_.size();
+}
+
+/**
+ * configuration:
+ *
+ * the index-th combination of the swept values, the seeds vary
+ * fastest and the switch totals slowest.  It runs alone and quietly.
+ */
+Parameter
+Parameter::configuration(unsigned int index) const
+{
+    Parameter c(*this);
+    vector<int> *swept[] = {&c.seed_, &c.dataRate_, &c.transmitRate_,
+                            &c.packetSize_, &c.switchPort_, &c.switchTotal_};
+
+    for (unsigned int i = 0; i < sizeof(swept) / sizeof(swept[0]); i++) {
+        vector<int> &v = *swept[i];
+        int value = v[index % v.size()];
+
+        index /= v.size();
+        v.assign(1, value);
+    }
+    c.format_ = "";
+    c.quiet_ = true;
+    return c;
+}
+
 Parameter::Parameter(int argc, char **argv)
-    :random_(false), packetSize_(PacketSize), switchTotal_(SwitchTotal),
-    switchPort_(SwitchPort), dataRate_(DataRate), transmitRate_(TransmitRate),
-    simulationTime_(Time(SimulationTime)), runningMode_(RealTime)
+    :random_(false), packetSize_(1, PacketSize), switchTotal_(1, SwitchTotal),
+    switchPort_(1, SwitchPort), dataRate_(1, DataRate), transmitRate_(1, TransmitRate),
+    seed_(1, 1), simulationTime_(Time(SimulationTime)), runningMode_(RealTime),
+    lazyCancel_(false), partitions_(1), propagationDelay_(0),
+    optimism_(0), adaptive_(false), batches_(false),
+    profile_(false), branchInterface_("master_switch_eth0"), workers_(0),
+    quiet_(false)
 {
     int c;
 
-    while ((c = getopt(argc, argv, "hrs:p:l:t:d:x:v")) > 0) {
+    while ((c = getopt(argc, argv, "hrs:p:l:t:d:x:vwcP:D:O:abfT:R:S:L:B:I:n:F:j:")) > 0) {
         switch (c) {
         case 'h':
             cout << "h  help" << endl;
@@ -117,6 +243,26 @@ Parameter::Parameter(int argc, char **argv)
             cout << "d  data rate (in mbps)" << endl;
             cout << "x  simulation time (in second)" << endl;
             cout << "v  running in virtual time" << endl;
+            cout << "w  use the timing wheel activity manager" << endl;
+            cout << "c  cancel rescheduled activities lazily" << endl;
+            cout << "P  partitions run in parallel (needs D)" << endl;
+            cout << "D  link propagation delay (in nanosecond)" << endl;
+            cout << "O  let partitions run ahead optimistically (in nanosecond)" << endl;
+            cout << "a  adapt the real time ratio to the fastest sustainable" << endl;
+            cout << "b  report how many events run at each timestamp" << endl;
+            cout << "f  report the activity profile (build with -DACTIVITY_PROFILE)" << endl;
+            cout << "T  record the events run to a trace file" << endl;
+            cout << "R  check the events run against a trace file" << endl;
+            cout << "S  checkpoint the simulation to a file when it ends" << endl;
+            cout << "L  start from a checkpoint instead of building the network" << endl;
+            cout << "B  fork a what-if branch once the run ends, attribute=value" << endl;
+            cout << "   applied to the I interface, it runs another x seconds" << endl;
+            cout << "I  interface the B branches change (master_switch_eth0)" << endl;
+            cout << "n  random seed of the packet sizes of r" << endl;
+            cout << "F  sweep every combination of s, p, l, t, d and n, printing" << endl;
+            cout << "   a csv or json table; these take lists and ranges, e.g." << endl;
+            cout << "   -s 10,20 -p 4:16:4" << endl;
+            cout << "j  sweep workers (one per processor)" << endl;
             exit(0);
             break;
 
@@ -125,23 +271,23 @@ Parameter::Parameter(int argc, char **argv)
             break;
 
         case 's':
-            switchTotal_ = atoi(optarg);
+            switchTotal_ = list(optarg);
             break;
 
         case 'p':
-            switchPort_ = atoi(optarg);
+            switchPort_ = list(optarg);
             break;
             
         case 'l':
-            packetSize_ = atoi(optarg);
+            packetSize_ = list(optarg);
             break;
 
         case 't':
-            transmitRate_ = atoi(optarg);
+            transmitRate_ = list(optarg);
             break;
 
         case 'd':
-            dataRate_ = atoi(optarg);
+            dataRate_ = list(optarg);
             break;
 
         case 'x':
@@ -151,8 +297,107 @@ Parameter::Parameter(int argc, char **argv)
         case 'v':
             runningMode_ = VirtualTime;
             break;
+
+        case 'w':
+            managerType_ = "timing wheel";
+            break;
+
+        case 'c':
+            lazyCancel_ = true;
+            break;
+
+        case 'P':
+            partitions_ = atoi(optarg);
+            managerType_ = "parallel";
+            break;
+
+        case 'D':
+            propagationDelay_ = atoi(optarg);
+            break;
+
+        case 'O':
+            optimism_ = atoi(optarg);
+            break;
+
+        case 'a':
+            adaptive_ = true;
+            break;
+
+        case 'b':
+            batches_ = true;
+            break;
+
+        case 'f':
+            profile_ = true;
+            break;
+
+        case 'T':
+            trace_ = optarg;
+            break;
+
+        case 'R':
+            replay_ = optarg;
+            break;
+
+        case 'S':
+            snapshot_ = optarg;
+            break;
+
+        case 'L':
+            restore_ = optarg;
+            break;
+
+        case 'B':
+            branches_.push_back(optarg);
+            break;
+
+        case 'I':
+            branchInterface_ = optarg;
+            break;
+
+        case 'n':
+            seed_ = list(optarg);
+            break;
+
+        case 'F':
+            format_ = optarg;
+            break;
+
+        case 'j':
+            workers_ = atoi(optarg);
+            break;
         }
     }
+    if (partitions_ > 1 && propagationDelay_ <= 0) {
+        cout << "running in parallel needs a propagation delay" << endl;
+        exit(1);
+    }
+    if (!branches_.empty() && (runningMode_ != VirtualTime || partitions_ > 1)) {
+        cout << "branches need a single partition run in virtual time" << endl;
+        exit(1);
+    }
+    if (!sweep() && configurations() > 1) {
+        cout << "lists and ranges need a sweep, see F" << endl;
+        exit(1);
+    }
+    if (seed_.size() > 1 && !random_) {
+        cout << "the seed only picks random packet sizes, a list of them needs r" << endl;
+        exit(1);
+    }
+    if (packetSize_.size() > 1 && random_) {
+        cout << "random packet sizes ignore l, it takes no list with r" << endl;
+        exit(1);
+    }
+    if (sweep() && format_ != "csv" && format_ != "json") {
+        cout << "a sweep prints csv or json" << endl;
+        exit(1);
+    }
+    if (sweep() && (runningMode_ != VirtualTime || !branches_.empty() ||
+                    !trace_.empty() || !replay_.empty() || 
+                    !snapshot_.empty() || !restore_.empty())) {
+        cout << "a sweep runs in virtual time, without T, R, S, L or B" << endl;
+        exit(1);
+    }
 #if 0
     if (runningMode_ == VirtualTime) {
         simulationTime_ = Time(simulationTime_.value() / 1000.0);
@@ -183,6 +428,49 @@ displayStatistic (Ptr<Instance::Manager> m, Ptr<Instance> inst)
     cout << endl;
 }
 
+/**
+ * WhatIf:
+ *
+ * branch applying one attribute change to an interface, it reports
+ * what host_dst received, its average latency and the drops at the
+ * changed interface
+ */
+class WhatIf : public Branch::Child {
+public:
+    string report();
+
+    WhatIf(Ptr<Simulation> simulation, Ptr<Instance::Manager> manager, 
+           const string &intf, const string &change, Time duration)
+        :simulation_(simulation), manager_(manager), interface_(intf), 
+        change_(change), duration_(duration) {}
+
+private:
+    Ptr<Simulation>         simulation_;
+    Ptr<Instance::Manager>  manager_;
+    string                  interface_;
+    string                  change_;
+    Time                    duration_;
+};
+
+string
+WhatIf::report()
+{
+    Ptr<Activity::Manager> am = simulation_->activityManager();
+    Ptr<Instance> intf = manager_->instance(interface_);
+    Ptr<Instance> host = manager_->instance("host_dst");
+    string::size_type equal = change_.find('=');
+
+    if (!intf || !host || equal == string::npos) {
+        throw ParserException();
+    }
+    intf->attributeIs(change_.substr(0, equal), change_.substr(equal + 1));
+    am->nowIs(am->now() + duration_);
+
+    return host->attribute("Packets Received") + " " + 
+           host->attribute("Average Latency") + " " + 
+           intf->attribute("Packets Dropped");
+}
+
 void
 display_exception()
 {
@@ -194,38 +482,35 @@ display_exception()
     }
 }
 
-int
-main(int argc, char **argv)
+/**
+ * build:
+ *
+ * a destination host behind a master switch, with switchTotal
+ * switches of switchPort source hosts each
+ */
+void
+build(Ptr<Instance::Manager> manager, const Parameter &param)
 {
-    Ptr<Activity::Manager>  realAM, virtualAM;
-    Parameter               param(argc, argv);
-    Ptr<Instance::Manager>  manager;
-
-    set_terminate(&display_exception);
-    set_unexpected(&display_exception);
-
-    // Grab all system wide variable
-    manager     = NetworkFactory();
-    realAM      = RealTimeActivityManager();
-    virtualAM   = ActivityManager();
-
-    // Reset virtual time
-    virtualAM->runningIs(false);
-    virtualAM->nowIs(0.0);
+    /*
+     * without a stream buffer the progress output goes nowhere
+     */
+    ostream out(param.quiet() ? NULL : cout.rdbuf());
 
-    cout << "Building instances ..." << endl;
+    srand(param.seed());
+    out << "Building instances ..." << endl;
 
     // create destination
-    cout << "Creating dst host ..." << endl;
+    out << "Creating dst host ..." << endl;
     Ptr<Instance>    host_dst;
     Ptr<Instance>    host_dst_intf;
     host_dst       = manager->instanceNew("host_dst", "IP host");
     host_dst_intf  = manager->instanceNew("host_dst_eth0", "Ethernet interface");
     host_dst_intf->attributeIs("data rate", param.dataRate());
+    host_dst_intf->attributeIs("propagation delay", param.propagationDelay());
     host_dst->attributeIs("interface0", "host_dst_eth0");
 
     // creates 100 hosts
-    cout << "Creating " << param.switchPort() * param.switchTotal() << " src hosts ..." << endl;
+    out << "Creating " << param.switchPort() * param.switchTotal() << " src hosts ..." << endl;
     vector<Ptr<Instance> >  host_src;
     vector<Ptr<Instance> >  host_src_intf;
     for (int i = 0; i < param.switchPort() * param.switchTotal(); i++) {
@@ -236,9 +521,16 @@ main(int argc, char **argv)
         sprintf(buf, "host_src%d", i);
         host = manager->instanceNew(buf, "IP host");
 
+        /*
+         * a host runs on the partition of its switch
+         */
+        sprintf(buf, "%d", (i / param.switchPort()) % param.partitions());
+        host->attributeIs("partition", buf);
+
         sprintf(buf, "host_src%d_eth0", i);
         intf = manager->instanceNew(buf, "Ethernet interface");
         intf->attributeIs("data rate", param.dataRate());
+        intf->attributeIs("propagation delay", param.propagationDelay());
         host->attributeIs("interface0", intf->name());
         host->attributeIs("Transmit Rate", param.transmitRate());
         host->attributeIs("Packet Size", param.packetSize());
@@ -251,7 +543,7 @@ main(int argc, char **argv)
     /*
      * create 10 switches
      */
-    cout << "Creating " << param.switchTotal() << " switches ..." << endl;
+    out << "Creating " << param.switchTotal() << " switches ..." << endl;
     vector<Ptr<Instance> > sw;
     vector<Ptr<Instance> > sw_intf;
     for (int i = 0; i < param.switchTotal(); i++) {
@@ -261,10 +553,13 @@ main(int argc, char **argv)
 
         sprintf(buf, "switch%d", i);
         eswitch = manager->instanceNew(buf, "Ethernet switch");
+        sprintf(buf, "%d", i % param.partitions());
+        eswitch->attributeIs("partition", buf);
 
         sprintf(buf, "switch%d_eth0", i);
         intf = manager->instanceNew(buf, "Ethernet interface");
         intf->attributeIs("data rate", param.dataRate());
+        intf->attributeIs("propagation delay", param.propagationDelay());
         eswitch->attributeIs("interface0", intf->name());
 
         sw.push_back(eswitch);
@@ -280,6 +575,7 @@ main(int argc, char **argv)
             sprintf(intf_name, "switch%d_eth%d", i, j+1);
             intf = manager->instanceNew(intf_name, "Ethernet interface");
             intf->attributeIs("data rate", param.dataRate());
+            intf->attributeIs("propagation delay", param.propagationDelay());
             sprintf(buf, "interface%d", j+1);
             eswitch->attributeIs(buf, intf->name());
 
@@ -290,12 +586,13 @@ main(int argc, char **argv)
     /*
      * create 1 master switch
      */
-    cout << "Creating master switch ..." << endl;
+    out << "Creating master switch ..." << endl;
     Ptr<Instance> master_switch;
     Ptr<Instance> master_switch_intf;
     master_switch = manager->instanceNew("master_switch", "Ethernet switch");
     master_switch_intf = manager->instanceNew("master_switch_eth0", "Ethernet interface");
     master_switch_intf->attributeIs("data rate", param.dataRate());
+    master_switch_intf->attributeIs("propagation delay", param.propagationDelay());
     master_switch->attributeIs("interface0", "master_switch_eth0");
 
     for (int i = 0; i < param.switchTotal(); i++) {
@@ -305,6 +602,7 @@ main(int argc, char **argv)
         sprintf(buf, "master_switch_eth%d", i+1);
         intf = manager->instanceNew(buf, "Ethernet interface");
         intf->attributeIs("data rate", param.dataRate());
+        intf->attributeIs("propagation delay", param.propagationDelay());
         intf->attributeIs("other side", sw_intf[i]->name());
 
         sprintf(buf, "interface%d", i+1);
@@ -315,7 +613,216 @@ main(int argc, char **argv)
      * Link master switch to destination
      */
     host_dst_intf->attributeIs("other side", "master_switch_eth0"); 
+}
+
+/**
+ * configure:
+ *
+ * set up the virtual time manager as the parameters ask, stopped
+ */
+void
+configure(Ptr<Activity::Manager> am, const Parameter &param)
+{
+    am->lazyCancelIs(param.lazyCancel());
+    if (param.partitions() > 1) {
+        am->partitionsIs(param.partitions());
+        am->lookaheadIs(param.lookahead());
+        am->optimismIs(param.optimism());
+    }
+    am->runningIs(false);
+}
+
+/**
+ * SweepRun:
+ *
+ * one configuration of a sweep.  Its worker is forked before anything
+ * is built; it builds and runs a simulation of its own and reports
+ * what host_dst received, its average latency, the drops at
+ * host_dst_eth0 and master_switch_eth0 and the seconds spent building
+ * and running.
+ */
+class SweepRun : public Branch::Child {
+public:
+    string report();
+
+    SweepRun(const Parameter &param) :param_(param) {}
+
+private:
+    Parameter   param_;
+};
+
+string
+SweepRun::report()
+{
+    Ptr<Simulation> simulation = SimulationFactory(param_.managerType());
+    Ptr<Instance::Manager> manager = NetworkFactory(simulation);
+    Ptr<Activity::Manager> am = simulation->activityManager();
+    struct timeval start, built, done;
+    char buf[1024];
+
+    gettimeofday(&start, NULL);
+    configure(am, param_);
+    am->nowIs(0.0);
+    build(manager, param_);
+    gettimeofday(&built, NULL);
+    am->runningIs(true);
+    am->nowIs(am->now() + param_.simulationTime());
+    gettimeofday(&done, NULL);
+
+    Ptr<Instance> host_dst = manager->instance("host_dst");
+    Ptr<Instance> host_dst_intf = manager->instance("host_dst_eth0");
+    Ptr<Instance> master_switch_intf = manager->instance("master_switch_eth0");
+
+    snprintf(buf, sizeof(buf), "%s %s %s %s %f %f",
+             host_dst->attribute("Packets Received").c_str(),
+             host_dst->attribute("Average Latency").c_str(),
+             host_dst_intf->attribute("Packets Dropped").c_str(),
+             master_switch_intf->attribute("Packets Dropped").c_str(),
+             (double)(Time(built) - Time(start)).value() / Time::SEC_TO_NANO,
+             (double)(Time(done) - Time(built)).value() / Time::SEC_TO_NANO);
+    return buf;
+}
+
+/**
+ * sweep:
+ *
+ * run every configuration on a pool of forked workers and print one
+ * table with a row per configuration, in order.  A configuration
+ * whose worker failed keeps its row, with status failed and no
+ * results.
+ */
+void
+sweep(const Parameter &param)
+{
+    static const char *column[] = {
+        "switches", "ports", "packet_size", "transmit_rate", "data_rate", 
+        "seed", "status", "received", "latency", "dst_dropped", 
+        "master_dropped", "build_seconds", "run_seconds"
+    };
+    static const unsigned int Columns = sizeof(column) / sizeof(column[0]);
+    static const unsigned int Results = 6;
+    Branch::Manager workers(SimulationFactory(""));
+    vector<Parameter> configuration;
+    vector<SweepRun *> run;
+    bool json = (param.format() == "json");
+
+    if (param.workers() > 0) {
+        workers.concurrencyIs(param.workers());
+    }
+    for (unsigned int i = 0; i < param.configurations(); i++) {
+        char name[100];
+
+        configuration.push_back(param.configuration(i));
+        run.push_back(new SweepRun(configuration.back()));
+        sprintf(name, "%u", i);
+        workers.branchNew(name, run.back());
+    }
+    workers.runningIs(0);
+
+    if (json) {
+        cout << "[" << endl;
+    } else {
+        for (unsigned int i = 0; i < Columns; i++) {
+            cout << (i ? "," : "") << column[i];
+        }
+        cout << endl;
+    }
+    for (unsigned int i = 0; i < workers.branches(); i++) {
+        Ptr<Branch> branch = workers.branch(i);
+        const Parameter &c = configuration[i];
+        char result[Results][100];
+        char buf[100];
+        vector<string> value;
+
+        sprintf(buf, "%d", c.switchTotal());
+        value.push_back(buf);
+        sprintf(buf, "%d", c.switchPort());
+        value.push_back(buf);
+        value.push_back(c.random() ? "random" : c.packetSize());
+        value.push_back(c.transmitRate());
+        value.push_back(c.dataRate());
+        sprintf(buf, "%u", c.seed());
+        value.push_back(buf);
+        if (branch->status() == Branch::Finished &&
+            sscanf(branch->report().c_str(), "%99s %99s %99s %99s %99s %99s",
+                   result[0], result[1], result[2], 
+                   result[3], result[4], result[5]) == (int)Results) {
+            value.push_back("ok");
+            for (unsigned int j = 0; j < Results; j++) {
+                value.push_back(result[j]);
+            }
+        } else {
+            value.push_back("failed");
+        }
+
+        if (!json) {
+            for (unsigned int j = 0; j < value.size(); j++) {
+                cout << (j ? "," : "") << value[j];
+            }
+            cout << endl;
+            continue;
+        }
+
+        /*
+         * packet_size may be random and status is text, the rest
+         * are numbers
+         */
+        cout << "  {";
+        for (unsigned int j = 0; j < value.size(); j++) {
+            const char *quote = (j == 6 || value[j] == "random") ? "\"" : "";
+
+            cout << (j ? ", " : "") << "\"" << column[j] << "\": " 
+                 << quote << value[j] << quote;
+        }
+        cout << "}" << (i + 1 < workers.branches() ? "," : "") << endl;
+    }
+    if (json) {
+        cout << "]" << endl;
+    }
+    for (unsigned int i = 0; i < run.size(); i++) {
+        delete run[i];
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    Ptr<Activity::Manager>  realAM, virtualAM;
+    Parameter               param(argc, argv);
+    Ptr<Instance::Manager>  manager;
+    Ptr<Simulation>         simulation;
+
+    set_terminate(&display_exception);
+    set_unexpected(&display_exception);
+
+    if (param.sweep()) {
+        sweep(param);
+        return 0;
+    }
+
+    // One simulation, its network and its managers
+    simulation  = SimulationFactory(param.managerType());
+    manager     = NetworkFactory(simulation);
+    virtualAM   = simulation->activityManager();
+    realAM      = simulation->realTimeActivityManager();
+
+    // Reset virtual time
+    configure(virtualAM, param);
+    if (param.restore().empty()) {
+        virtualAM->nowIs(0.0);
+        build(manager, param);
+    } else {
+        cout << "Restoring " << param.restore() << " ..." << endl;
+        manager->instance("config")->attributeIs("restore", param.restore());
+    }
+
     cout << "Running Simulation ..." << endl;
+    if (!param.trace().empty()) {
+        virtualAM->traceIs(param.trace());
+    }
+    if (!param.replay().empty()) {
+        virtualAM->replayIs(param.replay());
+    }
     struct timeval tv;
     gettimeofday(&tv, NULL);
 
@@ -324,6 +831,9 @@ main(int argc, char **argv)
         //Adjust current time
         realAM->runningIs(false);
         realAM->nowIs(tv);
+        if (param.adaptive()) {
+            manager->instance("config")->attributeIs("adaptive ratio", "true");
+        }
 
         // Run for 10 second
         virtualAM->runningIs(true);
@@ -331,6 +841,10 @@ main(int argc, char **argv)
         realAM->nowIs(realAM->now() + param.simulationTime());
         cout << "elapsed virtual time: " << virtualAM->now() << endl;
         cout << "elapsed real time: " << (realAM->now() - Time(tv)) << endl;
+        cout << "ratio: " << manager->instance("config")->attribute("ratio") << endl;
+        cout << "lag max: " << manager->instance("config")->attribute("lag max") << endl;
+        cout << "lag misses: " << manager->instance("config")->attribute("lag misses") << endl;
+        cout << "lag histogram: " << manager->instance("config")->attribute("lag histogram") << endl;
         break;
     }
 
@@ -340,7 +854,7 @@ main(int argc, char **argv)
         //virtualAM->nowIs(Time(8800001.0));
         //virtualAM->nowIs(Time(100000000.0));
         //virtualAM->nowIs(Time(200000000.0));
-        virtualAM->nowIs(param.simulationTime());
+        virtualAM->nowIs(virtualAM->now() + param.simulationTime());
         cout << "elapsed virtual time: " << virtualAM->now() << endl;
         break;
     }
@@ -348,8 +862,80 @@ main(int argc, char **argv)
     struct timeval current;
     gettimeofday(&current, NULL);
     cout << "elapsed actual time: " << Time(current) - Time(tv) << endl;
+    if (!param.trace().empty()) {
+        virtualAM->traceIs("");
+        cout << "trace events: " << virtualAM->traceEvents() << endl;
+    }
+    if (!param.replay().empty()) {
+        virtualAM->replayIs("");
+        cout << "replayed events: " << virtualAM->traceEvents() << endl;
+        cout << "replay mismatches: " << virtualAM->replayMismatches() << endl;
+    }
+    if (param.lazyCancel()) {
+        cout << "stale entry ratio: " << virtualAM->staleRatio() << endl;
+    }
+    if (param.batches()) {
+        cout << "batch histogram: " << manager->instance("config")->attribute("batch histogram") << endl;
+    }
+    if (param.profile()) {
+        vector<Activity::Profile> profile = virtualAM->profile();
+
+        printf("%-20s %12s %12s %12s %12s\n", 
+               "activity", "invocations", "notifiees", "total usec", "max usec");
+        for (unsigned int i = 0; i < profile.size(); i++) {
+            printf("%-20s %12llu %12llu %12lld %12lld\n", profile[i].key.c_str(),
+                   profile[i].invocations, profile[i].notifiees,
+                   (long long)profile[i].total.value() / Time::USEC_TO_NANO,
+                   (long long)profile[i].max.value() / Time::USEC_TO_NANO);
+        }
+    }
+    if (param.optimism() > param.lookahead() && param.partitions() > 1) {
+        cout << "rollbacks: " << virtualAM->rollbacks() << endl;
+        cout << "efficiency: " << virtualAM->efficiency() << endl;
+    }
+
+    if (!param.snapshot().empty()) {
+        manager->instance("config")->attributeIs("snapshot", param.snapshot());
+    }
+
+    if (!param.branches().empty()) {
+        vector<string> change = param.branches();
+        Branch::Manager branches(simulation);
+        vector<WhatIf *> whatIf;
+
+        cout << "Running " << change.size() << " branches ..." << endl;
+        for (unsigned int i = 0; i < change.size(); i++) {
+            whatIf.push_back(new WhatIf(simulation, manager, param.branchInterface(), 
+                                        change[i], param.simulationTime()));
+            branches.branchNew(change[i], whatIf.back());
+        }
+        branches.runningIs(0);
+
+        printf("%-30s %12s %16s %12s\n", "branch", "received", "latency", "dropped");
+        for (unsigned int i = 0; i < branches.branches(); i++) {
+            Ptr<Branch> branch = branches.branch(i);
+            char received[100], latency[100], dropped[100];
+
+            if (branch->status() != Branch::Finished || 
+                sscanf(branch->report().c_str(), "%99s %99s %99s", 
+                       received, latency, dropped) != 3) {
+                printf("%-30s failed\n", branch->name().c_str());
+                continue;
+            }
+            printf("%-30s %12s %16s %12s\n", 
+                   branch->name().c_str(), received, latency, dropped);
+        }
+        for (unsigned int i = 0; i < whatIf.size(); i++) {
+            delete whatIf[i];
+        }
+        cout << endl;
+    }
 
     cout << "Collecting Statistics ..." << endl;
+    Ptr<Instance> host_dst = manager->instance("host_dst");
+    Ptr<Instance> host_dst_intf = manager->instance("host_dst_eth0");
+    Ptr<Instance> switch0_intf = manager->instance("switch0_eth0");
+    Ptr<Instance> master_switch_intf = manager->instance("master_switch_eth0");
 
     cout << "host_dst" << endl;
     cout << "host_dst packets received: " << host_dst->attribute("Packets Received") << endl;
@@ -359,8 +945,8 @@ main(int argc, char **argv)
     cout << endl;
 
     cout << "switch0" << endl;
-    cout << "switch0_eth0 packets received: " << sw_intf[0]->attribute("Packets Received") << endl;
-    cout << "switch0_eth0 packets dropped: " << sw_intf[0]->attribute("Packets Dropped") << endl;
+    cout << "switch0_eth0 packets received: " << switch0_intf->attribute("Packets Received") << endl;
+    cout << "switch0_eth0 packets dropped: " << switch0_intf->attribute("Packets Dropped") << endl;
     cout << endl;
 
     cout << "master_switch" << endl;
@@ -10,14 +10,20 @@
 
 #include <string>
 #include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
 
 #include "Instance.h"
 #include "Notifiee.h"
 #include "Activity.h"
+#include "Simulation.h"
 
 extern Ptr<Instance::Manager> NetworkFactory();
+extern Ptr<Instance::Manager> NetworkFactory(Ptr<Simulation> simulation);
 extern Ptr<Activity::Manager> RealTimeActivityManager();
 extern Ptr<Activity::Manager> ActivityManager();
+extern Ptr<Activity::Manager> ActivityFactory(const string &type);
 
 void
 displayStatistic (Ptr<Instance::Manager> m, Ptr<Instance> inst)
@@ -42,6 +48,398 @@ displayStatistic (Ptr<Instance::Manager> m, Ptr<Instance> inst)
     cout << endl;
 }
 
+/*
+ * an Ethernet interface on a 10 Mbps link of the given delay
+ */
+Ptr<Instance>
+interfaceNew(Ptr<Instance::Manager> m, const string &name, const string &delay)
+{
+    Ptr<Instance> intf = m->instanceNew(name, "Ethernet interface");
+
+    intf->attributeIs("data rate", "10");
+    intf->attributeIs("propagation delay", delay);
+    return intf;
+}
+
+/**
+ * star:
+ *
+ * host_dst behind a master switch with switches switches of four
+ * hosts each, sending faster than the links carry so that queues
+ * overflow.  Switch i and its hosts run on partition i % partitions,
+ * every link is delay ns long.
+ */
+void
+star(Ptr<Instance::Manager> m, int switches, int partitions, const string &delay)
+{
+    Ptr<Instance> dst = m->instanceNew("host_dst", "IP host");
+    Ptr<Instance> master = m->instanceNew("master_switch", "Ethernet switch");
+    char name[100], buf[100];
+
+    interfaceNew(m, "host_dst_eth0", delay);
+    interfaceNew(m, "master_switch_eth0", delay);
+    dst->attributeIs("interface0", "host_dst_eth0");
+    master->attributeIs("interface0", "master_switch_eth0");
+    for (int i = 0; i < switches; i++) {
+        sprintf(name, "switch%d", i);
+        Ptr<Instance> sw = m->instanceNew(name, "Ethernet switch");
+        char partition[100];
+
+        sprintf(partition, "%d", i % partitions);
+        sw->attributeIs("partition", partition);
+        for (int j = 0; j <= 4; j++) {
+            sprintf(name, "switch%d_eth%d", i, j);
+            interfaceNew(m, name, delay);
+            sprintf(buf, "interface%d", j);
+            sw->attributeIs(buf, name);
+        }
+        for (int j = 0; j < 4; j++) {
+            sprintf(name, "host_src%d", i * 4 + j);
+            Ptr<Instance> host = m->instanceNew(name, "IP host");
+
+            host->attributeIs("partition", partition);
+            sprintf(name, "host_src%d_eth0", i * 4 + j);
+            interfaceNew(m, name, delay);
+            host->attributeIs("interface0", name);
+            host->attributeIs("Transmit Rate", "4");
+            host->attributeIs("Packet Size", "1024");
+            host->attributeIs("Destination", "host_dst");
+            sprintf(buf, "switch%d_eth%d", i, j + 1);
+            m->instance(buf)->attributeIs("other side", name);
+        }
+        sprintf(name, "master_switch_eth%d", i + 1);
+        interfaceNew(m, name, delay);
+        sprintf(buf, "interface%d", i + 1);
+        master->attributeIs(buf, name);
+        sprintf(buf, "switch%d_eth0", i);
+        m->instance(name)->attributeIs("other side", buf);
+    }
+    m->instance("host_dst_eth0")->attributeIs("other side", "master_switch_eth0");
+}
+
+/*
+ * what host_dst received, its average latency and the drops at every
+ * switch interface of a star, in one line
+ */
+string
+outcome(Ptr<Instance::Manager> m, int switches)
+{
+    Ptr<Instance> dst = m->instance("host_dst");
+    string s = dst->attribute("Packets Received") + " " + dst->attribute("Average Latency");
+    char name[100];
+
+    for (int i = 0; i < switches; i++) {
+        for (int j = 0; j <= 4; j++) {
+            sprintf(name, "switch%d_eth%d", i, j);
+            s += " " + m->instance(name)->attribute("Packets Dropped");
+        }
+    }
+    for (int i = 0; i <= switches; i++) {
+        sprintf(name, "master_switch_eth%d", i);
+        s += " " + m->instance(name)->attribute("Packets Dropped");
+    }
+    return s;
+}
+
+/*
+ * report a check, false if it failed.  A failure shows the first
+ * line where got and want part.
+ */
+bool
+check(const string &what, const string &got, const string &want)
+{
+    string::size_type i = 0, begin;
+
+    if (got == want) {
+        cout << what << ": ok" << endl;
+        return true;
+    }
+    while (i < got.size() && i < want.size() && got[i] == want[i]) {
+        i++;
+    }
+    begin = i == 0 ? 0 : got.rfind('\n', i - 1);
+    begin = begin == string::npos || i == 0 ? 0 : begin + 1;
+    cout << what << ": FAILED" << endl;
+    cout << "  got:  " << got.substr(begin, got.find('\n', begin) - begin) << endl;
+    cout << "  want: " << want.substr(begin, want.find('\n', begin) - begin) << endl;
+    return false;
+}
+
+/**
+ * checkpointCheck:
+ *
+ * a star run for a second, saved, restored into a fresh simulation
+ * and run for another second ends where an uninterrupted two second
+ * run does
+ */
+bool
+checkpointCheck()
+{
+    char file[] = "/tmp/verificationXXXXXX";
+    int fd = mkstemp(file);
+    string resumed, straight;
+
+    if (fd < 0) {
+        cout << "checkpoint: FAILED, no temporary file" << endl;
+        return false;
+    }
+    close(fd);
+    {
+        Ptr<Simulation> simulation = SimulationFactory("heap");
+        Ptr<Instance::Manager> m = NetworkFactory(simulation);
+        Ptr<Activity::Manager> am = simulation->activityManager();
+
+        am->runningIs(false);
+        am->nowIs(0.0);
+        star(m, 2, 1, "1000");
+        am->runningIs(true);
+        am->nowIs(Time(1));
+        m->instance("config")->attributeIs("snapshot", file);
+    }
+    {
+        Ptr<Simulation> simulation = SimulationFactory("heap");
+        Ptr<Instance::Manager> m = NetworkFactory(simulation);
+        Ptr<Activity::Manager> am = simulation->activityManager();
+
+        am->runningIs(false);
+        m->instance("config")->attributeIs("restore", file);
+        am->runningIs(true);
+        am->nowIs(am->now() + Time(1));
+        resumed = outcome(m, 2);
+    }
+    {
+        Ptr<Simulation> simulation = SimulationFactory("heap");
+        Ptr<Instance::Manager> m = NetworkFactory(simulation);
+        Ptr<Activity::Manager> am = simulation->activityManager();
+
+        am->runningIs(false);
+        am->nowIs(0.0);
+        star(m, 2, 1, "1000");
+        am->runningIs(true);
+        am->nowIs(Time(2));
+        straight = outcome(m, 2);
+    }
+    unlink(file);
+    return check("checkpoint", resumed, straight);
+}
+
+/**
+ * Schedule:
+ *
+ * a seeded mix of events for the order check.  Each event moves its
+ * own activity and two others to zero, near (below a microsecond),
+ * mid range or far (beyond 2^32 ns) ahead, or parks one at Never;
+ * it also starts a timer and cancels another one.  Every activity
+ * and timer run is appended to fired().
+ */
+class Schedule : public RootNotifiee {
+public:
+    typedef Ptr<Schedule> Ptr;
+
+    // Accessor
+    string  fired() const { return fired_; }
+
+    // Mutator
+    void    handleNotification(Activity *activity);
+    void    timerIs(unsigned int index);
+
+    // Constructor/Destructor
+    Schedule(Activity::Manager *manager, unsigned int activities, unsigned long events);
+
+private:
+    struct Fire {
+        Schedule        *schedule;
+        unsigned int    index;
+        void operator()() { schedule->timerIs(index); }
+    };
+
+    unsigned long long random();
+    Time    delay();
+    void    record(const string &what);
+    void    step();
+
+    Activity::Manager       *manager_;  // the manager holds the schedule, not the other way
+    vector<Activity::Handle> activity_;
+    vector<Activity::Timer> timer_;
+    unsigned long long      seed_;
+    unsigned long           events_;
+    string                  fired_;
+};
+
+Schedule::Schedule(Activity::Manager *manager, unsigned int activities, unsigned long events)
+    :manager_(manager), seed_(1), events_(events)
+{
+    char name[100];
+
+    for (unsigned int i = 0; i < activities; i++) {
+        sprintf(name, "a%u", i);
+        Activity::Ptr a = manager_->activityNew(name);
+
+        activity_.push_back(a->handle());
+        a->nextTimeIs(manager_->now() + delay());
+        a->timeoutNotifieeIs(this);
+    }
+}
+
+unsigned long long
+Schedule::random()
+{
+    seed_ = seed_ * 6364136223846793005ULL + 1442695040888963407ULL;
+    return seed_ >> 20;
+}
+
+Time
+Schedule::delay()
+{
+    switch (random() % 4) {
+    case 0:
+        return Time((int64_t)(random() % 4));
+    case 1:
+        return Time((int64_t)(random() % 1000));
+    case 2:
+        return Time((int64_t)(random() % 100000000));
+    default:
+        return Time((int64_t)((1ULL << 32) + random() % (1ULL << 40)));
+    }
+}
+
+void
+Schedule::record(const string &what)
+{
+    char buf[100];
+
+    sprintf(buf, "%lld ", (long long)manager_->now().value());
+    fired_ += buf + what + "\n";
+}
+
+/*
+ * what every event does once it is recorded
+ */
+void
+Schedule::step()
+{
+    Activity::Ptr a;
+    Fire fire;
+
+    if (events_ == 0 || --events_ == 0) {
+        return;
+    }
+    for (int k = 0; k < 2; k++) {
+        a = manager_->activity(activity_[random() % activity_.size()]);
+        a->nextTimeIs(random() % 8 ? manager_->now() + delay() : Activity::Never);
+        a->timeoutNotifieeIs(this);
+    }
+    fire.schedule = this;
+    fire.index = timer_.size();
+    timer_.push_back(manager_->timerNew(manager_->now() + delay(), fire));
+    manager_->timerDel(timer_[random() % timer_.size()]);
+}
+
+void
+Schedule::handleNotification(Activity *activity)
+{
+    record(activity->name());
+    if (events_ > 1) {
+        activity->nextTimeIs(manager_->now() + delay());
+        activity->timeoutNotifieeIs(this);
+    }
+    step();
+}
+
+void
+Schedule::timerIs(unsigned int index)
+{
+    char buf[100];
+
+    sprintf(buf, "t%u", index);
+    record(buf);
+    step();
+}
+
+/**
+ * orderCheck:
+ *
+ * the timing wheel runs a schedule in the order the heap does, with
+ * and without lazy cancel
+ */
+bool
+orderCheck()
+{
+    static const char *type[] = { "heap", "heap", "timing wheel", "timing wheel" };
+    string fired[4];
+    bool ok = true;
+
+    for (int i = 0; i < 4; i++) {
+        Ptr<Activity::Manager> am = ActivityFactory(type[i]);
+
+        am->lazyCancelIs(i % 2 == 1);
+        am->runningIs(false);
+        am->nowIs(0.0);
+        Schedule::Ptr schedule = new Schedule(am.value(), 300, 20000);
+
+        am->runningIs(true);
+        am->nowIs(Time((int64_t)1 << 62));
+        fired[i] = schedule->fired();
+    }
+    ok = check("order heap lazy cancel", fired[1], fired[0]) && ok;
+    ok = check("order timing wheel", fired[2], fired[0]) && ok;
+    ok = check("order timing wheel lazy cancel", fired[3], fired[0]) && ok;
+    return ok;
+}
+
+/*
+ * a star of four switches on a new simulation of the given type, in
+ * partitions partitions no further apart than the lookahead, run for
+ * a second; speculation runs optimism ahead of the lookahead
+ */
+string
+starRun(const string &type, unsigned int partitions, Time optimism, 
+        unsigned long long *rollbacks)
+{
+    Ptr<Simulation> simulation = SimulationFactory(type);
+    Ptr<Instance::Manager> m = NetworkFactory(simulation);
+    Ptr<Activity::Manager> am = simulation->activityManager();
+
+    if (partitions > 1) {
+        am->partitionsIs(partitions);
+        am->lookaheadIs(Time((int64_t)20000));
+        am->optimismIs(optimism);
+    }
+    am->runningIs(false);
+    am->nowIs(0.0);
+    star(m, 4, partitions, "20000");
+    am->runningIs(true);
+    am->nowIs(Time(1));
+    if (rollbacks) {
+        *rollbacks = am->rollbacks();
+    }
+    return outcome(m, 4);
+}
+
+/**
+ * parallelCheck:
+ *
+ * a partitioned run, conservative or rolled back where it sped
+ * ahead, delivers, drops and delays every packet as the sequential
+ * one does
+ */
+bool
+parallelCheck()
+{
+    string sequential = starRun("heap", 1, Time(), NULL);
+    unsigned long long rollbacks;
+    bool ok = true;
+
+    ok = check("parallel conservative", starRun("parallel", 2, Time(), NULL), sequential) && ok;
+    ok = check("parallel optimistic", starRun("parallel", 2, Time((int64_t)100000), &rollbacks), 
+               sequential) && ok;
+    if (rollbacks == 0) {
+        cout << "parallel optimistic: FAILED, nothing was rolled back" << endl;
+        ok = false;
+    }
+    return ok;
+}
+
 /*
 
 Diagram
@@ -231,6 +629,15 @@ main(int argc, char *argv[])
     cout << "r1eth0 packets dropped: " << r1eth0->attribute("Packets Dropped") << endl;
     cout << "r1eth1 packets received: " << r1eth1->attribute("Packets Received") << endl;
     cout << "r1eth1 packets dropped: " << r1eth1->attribute("Packets Dropped") << endl;
+    cout << endl;
+
+    bool ok = true;
+
+    ok = checkpointCheck() && ok;
+    ok = orderCheck() && ok;
+    ok = parallelCheck() && ok;
+
+    return ok ? 0 : 1;
 }
 
 